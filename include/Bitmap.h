@@ -0,0 +1,44 @@
+#ifndef QS_BITMAP_H
+#define QS_BITMAP_H
+
+#include <cstdint>
+#include <cstddef>
+
+// word-level helpers for plain vertex bitmaps (one bit per vertex id)
+namespace bitmap {
+
+    inline size_t noWords(uint32_t noVertices) {
+        return (noVertices + 63) / 64;
+    }
+
+    inline void set(uint64_t *bits, uint32_t i) {
+        bits[i >> 6] |= (uint64_t) 1 << (i & 63);
+    }
+
+    inline bool test(const uint64_t *bits, uint32_t i) {
+        return (bits[i >> 6] >> (i & 63)) & 1;
+    }
+
+    // dst |= src over the given number of words
+    void orInto(uint64_t *dst, const uint64_t *src, size_t words);
+
+    // number of set bits
+    uint64_t popcount(const uint64_t *bits, size_t words);
+
+    // writes the positions of the set bits in ascending order, returns how many were written
+    size_t extract(const uint64_t *bits, size_t words, uint32_t *out);
+
+    template <typename F>
+    inline void forEach(const uint64_t *bits, size_t words, F f) {
+        for(size_t w = 0; w < words; w++) {
+            uint64_t word = bits[w];
+            while(word != 0) {
+                f((uint32_t) (w * 64 + __builtin_ctzll(word)));
+                word &= word - 1;
+            }
+        }
+    }
+
+}
+
+#endif //QS_BITMAP_H
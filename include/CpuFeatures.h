@@ -0,0 +1,46 @@
+#ifndef QS_CPUFEATURES_H
+#define QS_CPUFEATURES_H
+
+// runtime detection of the instruction sets the vectorized kernels are compiled for,
+// the kernels themselves are built with target attributes so the binary stays portable
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define QS_X86_DISPATCH 1
+#define QS_TARGET(isa) __attribute__((target(isa)))
+#else
+#define QS_X86_DISPATCH 0
+#define QS_TARGET(isa)
+#endif
+
+namespace cpu {
+
+    inline bool hasAVX2() {
+#if QS_X86_DISPATCH
+        static const bool supported = __builtin_cpu_supports("avx2");
+        return supported;
+#else
+        return false;
+#endif
+    }
+
+    inline bool hasSSE41() {
+#if QS_X86_DISPATCH
+        static const bool supported = __builtin_cpu_supports("sse4.1");
+        return supported;
+#else
+        return false;
+#endif
+    }
+
+    inline bool hasPopcnt() {
+#if QS_X86_DISPATCH
+        static const bool supported = __builtin_cpu_supports("popcnt");
+        return supported;
+#else
+        return false;
+#endif
+    }
+
+}
+
+#endif //QS_CPUFEATURES_H
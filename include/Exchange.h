@@ -0,0 +1,69 @@
+#ifndef QS_EXCHANGE_H
+#define QS_EXCHANGE_H
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// blocking, length-prefixed messages over a connected stream socket
+namespace channel {
+
+    void send(int fd, const void *data, size_t bytes);
+    void receive(int fd, void *data, size_t bytes);
+
+    void sendString(int fd, const std::string &s);
+    std::string receiveString(int fd);
+
+    void sendKeys(int fd, const std::vector<uint32_t> &keys);
+    std::vector<uint32_t> receiveKeys(int fd);
+
+}
+
+// thrown by every worker of an exchange round in which a peer aborted or dropped out
+class ExchangeAborted : public std::runtime_error {
+public:
+    explicit ExchangeAborted(const std::string &what) : std::runtime_error(what) {}
+};
+
+// exchange operator of a partitioned evaluation: every worker holds one connected stream
+// socket to each other worker and redistributes keys by the shard that owns them. the peers
+// are plain socket descriptors, unix socket pairs on one machine or tcp connections later.
+class Exchange {
+
+    uint32_t rank;
+    std::vector<int> peers; // indexed by rank, -1 for the own rank
+    uint64_t sent_keys;
+    bool broken; // the links were shut down after a failure mid-round
+
+    std::vector<uint64_t> round(std::vector<std::vector<uint64_t>> &outgoing, bool abort);
+    void breakLinks();
+
+public:
+
+    Exchange(uint32_t rank, std::vector<int> peers);
+    ~Exchange(); // closes the peer sockets
+
+    Exchange(const Exchange &) = delete;
+    Exchange &operator=(const Exchange &) = delete;
+
+    uint32_t getRank() const { return rank; }
+    uint32_t getNoPeers() const { return (uint32_t) peers.size(); }
+    uint64_t getNoSentKeys() const { return sent_keys; }
+
+    // every worker calls this in the same round: outgoing[r] goes to rank r, the result holds
+    // the keys all ranks addressed to this one, outgoing[rank] included. sends and receives
+    // are interleaved with poll so no pair of workers can block each other on full buffers.
+    // a failed round shuts the links down, so every peer fails its round too instead of
+    // waiting on this one; a peer that goes away fails the round here the same way.
+    std::vector<uint64_t> allToAll(std::vector<std::vector<uint64_t>> &outgoing);
+
+    // takes part in the current round with an abort instead of keys, for a worker that failed
+    // between rounds: the round still completes everywhere, then every peer throws
+    // ExchangeAborted and the links stay usable for the next query
+    void abort();
+
+};
+
+
+#endif //QS_EXCHANGE_H
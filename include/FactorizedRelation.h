@@ -0,0 +1,37 @@
+#ifndef QS_FACTORIZEDRELATION_H
+#define QS_FACTORIZEDRELATION_H
+
+#include <cstdint>
+#include <memory>
+#include "Estimator.h"
+#include "HybridRelation.h"
+
+// join result kept factorized: a union of products S_v x T_v, one per join vertex v, instead
+// of the flat pairs. row v of the sources relation holds S_v and row v of the targets relation
+// holds T_v, so the flat relation is sources^T joined with targets. a hub with 100k sources on
+// one side and 100k targets on the other takes 200k entries instead of 10^10 pairs.
+class FactorizedRelation {
+
+    std::shared_ptr<HybridRelation> sources;
+    std::shared_ptr<HybridRelation> targets;
+
+public:
+
+    FactorizedRelation(std::shared_ptr<HybridRelation> sourcesByVertex, std::shared_ptr<HybridRelation> targetsByVertex);
+
+    FactorizedRelation(const FactorizedRelation &) = delete;
+    FactorizedRelation &operator=(const FactorizedRelation &) = delete;
+
+    uint32_t getNoVertices() const { return sources->getNoVertices(); }
+    const std::shared_ptr<HybridRelation> &getSources() const { return sources; }
+    const std::shared_ptr<HybridRelation> &getTargets() const { return targets; }
+
+    // distinct sources, pairs and targets of the flat relation, without flattening it. sources
+    // that sit in the products of the same join vertices share their target set, so the pairs
+    // are counted once per such group of sources instead of once per source.
+    cardStat count() const;
+
+};
+
+
+#endif //QS_FACTORIZEDRELATION_H
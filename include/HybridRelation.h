@@ -0,0 +1,98 @@
+#ifndef QS_HYBRIDRELATION_H
+#define QS_HYBRIDRELATION_H
+
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include "Bitmap.h"
+#include "QueryArena.h"
+
+// binary relation over the vertices of a graph (source -> set of targets), used for the
+// intermediate results of the evaluator. every target set is kept distinct and is stored
+// either as a sorted array or, once it gets dense, as a bitmap over all vertices.
+// all storage comes from an ArenaRegion: two flat per-vertex arrays (row size and row
+// pointer) plus the row payloads, bump-allocated in the order the rows are set.
+class HybridRelation {
+
+    uint32_t V;
+    size_t W; // words per bitmap row
+    ArenaRegion region;
+    uint32_t *cards;
+    const void **payloads;
+
+public:
+
+    HybridRelation(uint32_t n, std::shared_ptr<QueryArena> arena);
+    ~HybridRelation() = default;
+
+    HybridRelation(const HybridRelation &) = delete;
+    HybridRelation &operator=(const HybridRelation &) = delete;
+
+    uint32_t getNoVertices() const { return V; }
+    size_t getNoWords() const { return W; }
+    const std::shared_ptr<QueryArena> &getArena() const { return region.getArena(); }
+
+    uint32_t getRowSize(uint32_t source) const { return cards[source]; }
+    bool isDense(uint32_t source) const { return shouldBeDense(cards[source]); }
+    const uint32_t *getTargets(uint32_t source) const { return static_cast<const uint32_t *>(payloads[source]); }
+    const uint64_t *getBits(uint32_t source) const { return static_cast<const uint64_t *>(payloads[source]); }
+
+    // a bitmap row takes V/8 bytes, a sorted array 4 bytes per target
+    bool shouldBeDense(uint64_t card) const { return card * 32 > V; }
+
+    // takes a sorted, distinct target list
+    void setRow(uint32_t source, const uint32_t *targets, uint32_t card);
+    void setRow(uint32_t source, const std::vector<uint32_t> &targets) {
+        setRow(source, targets.data(), (uint32_t) targets.size());
+    }
+    // takes a bitmap over all vertices with card bits set
+    void setRow(uint32_t source, const uint64_t *bits, uint32_t card);
+
+    // storage for a row of card targets that the caller fills in itself: card sorted values
+    // for a sparse row, or a zeroed bitmap of W words when shouldBeDense(card)
+    void *reserveRow(uint32_t source, uint32_t card);
+
+    // bytes of the per-vertex arrays and all rows, alignment padding left out
+    size_t getNoBytes() const;
+    // the same with the padding, kept up to date as rows are set
+    size_t getUsedBytes() const { return region.getUsedBytes(); }
+
+    // ors the target set of the row into a bitmap over all vertices
+    void unionInto(uint32_t source, uint64_t *bits) const;
+
+    // relation with every (source, target) pair flipped, built in the same arena
+    std::shared_ptr<HybridRelation> transpose() const;
+
+    // builds a relation from (source << 32 | target) keys, sorts and deduplicates them in place
+    static std::shared_ptr<HybridRelation> fromPairs(uint32_t n, std::vector<uint64_t> &pairs,
+                                                     std::shared_ptr<QueryArena> arena);
+
+    template <typename F>
+    void forEachTarget(uint32_t source, F f) const {
+        uint32_t card = cards[source];
+        if(card == 0) return;
+        if(shouldBeDense(card)) bitmap::forEach(getBits(source), W, f);
+        else for(const uint32_t *t = getTargets(source), *end = t + card; t != end; ++t) f(*t);
+    }
+
+    // calls f(source, targets, card) for every non-empty row in ascending source order, a dense
+    // row is extracted into row first
+    template <typename F>
+    void forEachRow(std::vector<uint32_t> &row, F f) const {
+        for(uint32_t source = 0; source < V; source++) {
+            uint32_t card = cards[source];
+            if(card == 0) continue;
+            if(shouldBeDense(card)) {
+                row.resize(card);
+                bitmap::extract(getBits(source), W, row.data());
+                f(source, row.data(), row.size());
+            } else {
+                f(source, getTargets(source), card);
+            }
+        }
+    }
+
+};
+
+
+#endif //QS_HYBRIDRELATION_H
@@ -0,0 +1,50 @@
+#ifndef QS_OPERATORKERNELS_H
+#define QS_OPERATORKERNELS_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include "Estimator.h"
+#include "HybridRelation.h"
+#include "SpilledRelation.h"
+#include "SimpleGraph.h"
+
+// the operators that read a label from the adjacency lists of the graph, specialized at
+// compile time on the direction of the label, on which semi-join filters are set and on the
+// representation of the left input. the evaluator looks the specialization of an operator up
+// once, before it runs; inside, every row is read only over the range of its label, so the
+// loops check neither the direction nor the label per edge. the generic versions decide all
+// of it per edge and are kept as the reference for the kernel benchmark.
+namespace kernels {
+
+    // the label as a relation, rows restricted to the filtered sources and targets
+    typedef void (*ProjectKernel)(const SimpleGraph &graph, uint32_t label, const uint64_t *sourceFilter,
+                                  const uint64_t *targetFilter, HybridRelation &out);
+    ProjectKernel projectKernel(bool inverse, bool sourceFilter, bool targetFilter);
+
+    // (noOut, noPaths, noIn) of the label, without materializing it
+    typedef cardStat (*CountKernel)(const SimpleGraph &graph, uint32_t label);
+    CountKernel countKernel(bool inverse);
+
+    // forward probe of the left rows over the label: every output row is the union of the label
+    // targets of the middles in a left row. the left input is a relation or a spilled relation.
+    template <typename Left>
+    using ProbeKernel = void (*)(const SimpleGraph &graph, uint32_t label, const uint64_t *targetFilter,
+                                 const Left &left, RowSink &out);
+    template <typename Left>
+    ProbeKernel<Left> probeKernel(bool inverse, bool targetFilter);
+
+    // name of a specialization, e.g. "inverse, target filter"
+    std::string describe(bool inverse, bool sourceFilter, bool targetFilter);
+
+    namespace generic {
+        void project(const SimpleGraph &graph, uint32_t label, bool inverse, const uint64_t *sourceFilter,
+                     const uint64_t *targetFilter, HybridRelation &out);
+        cardStat count(const SimpleGraph &graph, uint32_t label, bool inverse);
+        void probe(const SimpleGraph &graph, uint32_t label, bool inverse, const uint64_t *targetFilter,
+                   const HybridRelation &left, RowSink &out);
+    }
+
+}
+
+#endif //QS_OPERATORKERNELS_H
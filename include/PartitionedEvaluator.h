@@ -0,0 +1,47 @@
+#ifndef QS_PARTITIONEDEVALUATOR_H
+#define QS_PARTITIONEDEVALUATOR_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include "Estimator.h"
+#include "Exchange.h"
+#include "RPQTree.h"
+#include "SimpleGraph.h"
+
+// evaluation over a graph hash-partitioned across worker processes. every worker loads only
+// its shard of adj / reverse_adj; a chain query is evaluated as a frontier of (source, vertex)
+// pairs that always lives on the worker owning the vertex, and after every label the exchange
+// sends each new pair to the owner of its end vertex. this process is the coordinator: it
+// hands out the queries and merges the per-shard counts into one cardStat.
+class PartitionedEvaluator {
+
+    uint32_t no_workers;
+    std::vector<pid_t> workers;
+    std::vector<int> channels; // coordinator side of the socket to every worker
+    uint64_t no_exchanged_pairs;
+
+    void shutdown();
+    static void runWorker(uint32_t rank, const std::string &graphFile, int channel, Exchange &exchange);
+    static cardStat evaluateShard(RPQTree *query, std::shared_ptr<SimpleGraph> &graph, Exchange &exchange,
+                                  std::vector<uint32_t> &sources);
+
+public:
+
+    // forks the workers, which load their shards before the constructor returns
+    PartitionedEvaluator(const std::string &graphFile, uint32_t noWorkers);
+    ~PartitionedEvaluator(); // stops and reaps the workers
+
+    PartitionedEvaluator(const PartitionedEvaluator &) = delete;
+    PartitionedEvaluator &operator=(const PartitionedEvaluator &) = delete;
+
+    cardStat evaluate(const std::string &path);
+
+    uint32_t getNoWorkers() const { return no_workers; }
+    uint64_t getNoExchangedPairs() const { return no_exchanged_pairs; } // of the last query
+
+};
+
+
+#endif //QS_PARTITIONEDEVALUATOR_H
@@ -0,0 +1,115 @@
+#ifndef QS_QUERYARENA_H
+#define QS_QUERYARENA_H
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// thrown when a query needs more memory than its limit allows
+class MemoryLimitExceeded : public std::runtime_error {
+public:
+    explicit MemoryLimitExceeded(const std::string &what) : std::runtime_error(what) {}
+};
+
+// pool of large memory chunks that backs the intermediate relations of one query. relations
+// bump-allocate from their own ArenaRegion and hand the chunks back to the pool when they
+// die, so the chunks get reused by later relations of the same query; release() returns
+// everything to the system in bulk once the query is done.
+// the arena also does the memory accounting of a query: the bytes the live regions have
+// handed out plus the scratch buffers that joins track while they exist, the peak of the two,
+// and an optional limit. chunk slack and pooled chunks are not counted, so the numbers follow
+// the size of the relations, not how many of them are alive.
+class QueryArena {
+
+public:
+    struct Chunk {
+        char *data;
+        size_t size;
+    };
+
+private:
+    size_t chunk_size;
+    std::vector<Chunk> free_chunks;
+    size_t no_allocations; // chunks ever taken from the system
+    size_t reserved_bytes; // bytes currently held, free or in use
+    size_t used_bytes; // handed out by live regions
+    size_t tracked_bytes; // scratch memory outside the chunks
+    size_t peak_bytes;
+    size_t limit; // 0 for none
+
+    void checkLimit(size_t extraBytes);
+
+public:
+
+    explicit QueryArena(size_t chunkSize = 4u << 20);
+    ~QueryArena();
+
+    QueryArena(const QueryArena &) = delete;
+    QueryArena &operator=(const QueryArena &) = delete;
+
+    size_t getChunkSize() const { return chunk_size; }
+    size_t getNoAllocations() const { return no_allocations; }
+    size_t getReservedBytes() const { return reserved_bytes; }
+    size_t getCurrentBytes() const { return used_bytes + tracked_bytes; }
+    size_t getPeakBytes() const { return peak_bytes; }
+
+    // a limit on the current bytes, going over it throws MemoryLimitExceeded
+    void setLimit(size_t bytes) { limit = bytes; }
+    size_t getLimit() const { return limit; }
+
+    // restarts the peak and the scratch accounting for the next query
+    void startQuery();
+    void track(size_t bytes);
+    void untrack(size_t bytes);
+
+    // bytes handed out by a region, or given back when it dies
+    void use(size_t bytes);
+    void unuse(size_t bytes);
+
+    // a free chunk of at least minBytes, reusing a pooled one when it is not much larger
+    Chunk acquire(size_t minBytes);
+    void giveBack(Chunk chunk);
+
+    // frees every pooled chunk, chunks still held by a region stay valid
+    void release();
+
+};
+
+// bump allocator over chunks of a QueryArena, owned by a single relation. the bump chunks
+// start small and double up to the chunk size of the arena, so a small relation does not sit
+// on a whole chunk
+class ArenaRegion {
+
+    std::shared_ptr<QueryArena> arena;
+    std::vector<QueryArena::Chunk> chunks;
+    char *cursor;
+    size_t remaining;
+    size_t next_chunk; // size of the next bump chunk
+    size_t used_bytes; // handed out, alignment included
+
+public:
+
+    explicit ArenaRegion(std::shared_ptr<QueryArena> a);
+    ~ArenaRegion();
+
+    ArenaRegion(const ArenaRegion &) = delete;
+    ArenaRegion &operator=(const ArenaRegion &) = delete;
+
+    const std::shared_ptr<QueryArena> &getArena() const { return arena; }
+    size_t getUsedBytes() const { return used_bytes; }
+
+    // 32-byte aligned, uninitialized
+    void *allocate(size_t bytes);
+
+    template <typename T>
+    T *allocate(size_t n) {
+        return static_cast<T *>(allocate(n * sizeof(T)));
+    }
+
+};
+
+
+#endif //QS_QUERYARENA_H
@@ -0,0 +1,64 @@
+#ifndef QS_REACHABILITYINDEX_H
+#define QS_REACHABILITYINDEX_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "SimpleGraph.h"
+
+// per-label reachability index for closure checks between two given vertices ("does s reach t
+// over zero or more a-edges"). the subgraph of every label is condensed into its strongly
+// connected components, numbered in reverse topological order, and every component of the
+// resulting dag gets GRAIL interval labels from a few randomized depth-first traversals:
+// if t is reachable from s, the interval of t lies within the interval of s in every one of
+// them. most negative answers stop at the component numbers or the intervals; the remaining
+// checks run a depth-first search over the dag that prunes on both. a label is indexed on
+// its first check; labels whose index could be larger than the limit per label, or than what
+// is left of the total limit, are answered by a plain traversal of the graph.
+class ReachabilityIndex {
+
+    static const uint32_t noTraversals = 2;
+
+    struct LabelIndex {
+        bool built = false; // indexed or given up on
+        bool indexed = false;
+        std::vector<uint32_t> component; // per vertex
+        std::vector<uint32_t> dagOffsets; // dag adjacency over the components
+        std::vector<uint32_t> dagTargets;
+        std::vector<uint32_t> intervals; // (low, rank) per traversal, per component
+    };
+
+    std::shared_ptr<SimpleGraph> graph;
+    size_t max_bytes; // per label
+    size_t max_total_bytes;
+    std::vector<LabelIndex> labels;
+    size_t no_bytes;
+    double build_time; // ms, of the labels built so far
+
+    // the dag search keeps its state here between checks
+    mutable std::vector<uint32_t> visited;
+    mutable uint32_t visit_stamp;
+    mutable std::vector<uint32_t> stack;
+
+    void buildLabel(uint32_t label, LabelIndex &index);
+    bool contains(const LabelIndex &index, uint32_t outer, uint32_t inner) const;
+    bool traverse(uint32_t source, uint32_t target, uint32_t label) const;
+
+public:
+
+    ReachabilityIndex(std::shared_ptr<SimpleGraph> g, size_t maxBytesPerLabel, size_t maxTotalBytes);
+
+    // drops every label index, each label is built again on its next check
+    void clear();
+
+    // source reaches target over zero or more edges of label (the reflexive-transitive closure)
+    bool reachable(uint32_t source, uint32_t target, uint32_t label);
+
+    bool isIndexed(uint32_t label) const { return label < labels.size() && labels[label].indexed; }
+    size_t getNoBytes() const { return no_bytes; }
+    double getBuildTime() const { return build_time; }
+
+};
+
+
+#endif //QS_REACHABILITYINDEX_H
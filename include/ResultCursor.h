@@ -0,0 +1,56 @@
+#ifndef QS_RESULTCURSOR_H
+#define QS_RESULTCURSOR_H
+
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <vector>
+#include "SimpleGraph.h"
+
+// streams the distinct (source, target) pairs of a chain query, ordered by source and then
+// target. the answer is built one source at a time by expanding that source through the whole
+// chain, so the first pairs come out before the rest of the answer exists, and a limit or an
+// early close() stops the work. an open cursor holds a read lock on the graph, merges of
+// staged updates wait until it is closed.
+class ResultCursor {
+
+    std::shared_ptr<SimpleGraph> graph;
+    std::shared_lock<std::shared_timed_mutex> snapshot;
+    std::vector<std::pair<uint32_t, bool>> chain; // (label, inverse)
+    std::vector<std::vector<uint64_t>> level_filters; // semi-join reduction, empty when not reduced
+    uint64_t limit; // 0 for none
+    uint64_t no_returned;
+    uint32_t next_source;
+
+    // targets of the current source not returned yet
+    uint32_t row_source;
+    std::vector<uint32_t> row;
+    size_t row_position;
+
+    std::vector<uint32_t> frontier;
+    std::vector<uint32_t> expanded;
+
+    bool expandNextSource();
+
+public:
+
+    ResultCursor(std::shared_ptr<SimpleGraph> g, std::shared_lock<std::shared_timed_mutex> lock,
+                 std::vector<std::pair<uint32_t, bool>> labels, std::vector<std::vector<uint64_t>> filters,
+                 uint64_t limit);
+
+    ResultCursor(const ResultCursor &) = delete;
+    ResultCursor &operator=(const ResultCursor &) = delete;
+
+    // replaces the batch with up to batchSize further pairs, 0 once the cursor is exhausted
+    size_t nextBatch(std::vector<std::pair<uint32_t, uint32_t>> &batch, size_t batchSize = 1024);
+
+    uint64_t getNoReturned() const { return no_returned; }
+    bool isOpen() const { return snapshot.owns_lock(); }
+
+    // stops the cursor and releases the graph
+    void close();
+
+};
+
+
+#endif //QS_RESULTCURSOR_H
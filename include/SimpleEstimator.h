@@ -17,7 +17,10 @@ public:
 
     uint32_t* total_tuples_in;
     uint32_t* distinct_tuples_in;
+    uint32_t distinct_sources;
+    uint32_t distinct_targets;
     double correction;
+    size_t listener_id;
 
 
     explicit SimpleEstimator(std::shared_ptr<SimpleGraph> &g);
@@ -25,6 +28,7 @@ public:
 
     void prepare() override ;
     cardStat estimate(RPQTree *q) override ;
+    void applyDelta(const GraphDelta &delta);
 };
 
 
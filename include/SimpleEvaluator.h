@@ -10,6 +10,13 @@
 #include <cmath>
 #include <set>
 #include "SimpleGraph.h"
+#include "HybridRelation.h"
+#include "SpilledRelation.h"
+#include "ResultCursor.h"
+#include "FactorizedRelation.h"
+#include "ViewCatalog.h"
+#include "ReachabilityIndex.h"
+#include "QueryArena.h"
 #include "RPQTree.h"
 #include "Evaluator.h"
 #include "Graph.h"
@@ -17,32 +24,122 @@
 
 
 
+// physical join implementations, one is picked per join by SimpleEvaluator::chooseJoin
+enum class JoinAlgorithm { ForwardProbe, BackwardProbe, HashJoin, SortMerge };
+
+// one side of a join: a materialized relation, a relation spilled to disk, a factorized
+// relation, or a label that is read straight from the adjacency lists of the graph
+struct JoinInput {
+    std::shared_ptr<HybridRelation> relation; // nullptr for a label of the graph or a spilled relation
+    uint32_t label;
+    bool inverse;
+    cardStat stats; // estimated unless the input was materialized without an estimator
+    const uint64_t *sourceFilter; // semi-join reduction of a leaf, nullptr when unreduced
+    const uint64_t *targetFilter;
+    std::shared_ptr<SpilledRelation> spilled; // set instead of relation once a result outgrew the budget
+    std::shared_ptr<FactorizedRelation> factorized; // set instead of relation for a high fan-out result
+
+    bool isLeaf() const { return relation == nullptr && spilled == nullptr && factorized == nullptr; }
+};
+
 class SimpleEvaluator : public Evaluator {
 
     std::shared_ptr<SimpleGraph> graph;
     std::shared_ptr<SimpleEstimator> est;
     uint32_t* total_tuples;
+    uint32_t noEdges;
+    double probeDegreeOut;
+    double probeDegreeIn;
+    size_t listener_id;
     std::vector<std::pair<uint32_t, cardStat>> query_labels;
     std::vector<bool> inversed_list;
     std::vector<bool> query_order;
+    std::vector<std::vector<uint64_t>> level_filters; // per chain level vertex bitsets
+    double replan_threshold; // q-error of a join result that triggers re-planning
+    std::shared_ptr<QueryArena> arena; // backs every intermediate relation of a query
+    size_t no_arena_allocations;
+    size_t memory_budget; // bytes of intermediate results kept in memory, 0 for no limit
+    std::string spill_directory;
+    size_t memory_limit; // per query, 0 for none
+    size_t graph_memory;
+    size_t peak_memory; // of the last query, graph included
+    size_t current_memory;
+    bool spilled_for_limit; // the last query hit the limit and was rerun with spilling
+    double factorize_threshold; // flat / factorized size ratio from which a join stays factorized, 0 never
+    size_t no_factorized_joins;
+    std::shared_ptr<ViewCatalog> views; // nullptr unless a workload was given
+    std::vector<std::string> view_workload;
+    std::string view_file;
+    size_t no_view_hits;
+    size_t reachability_limit; // bytes of reachability index per label, 0 for no index
+    size_t reachability_total_limit; // bytes of reachability index over all labels
+    std::unique_ptr<ReachabilityIndex> reachability;
+
+    cardStat evaluateChain(RPQTree *query);
+    void prepareViews(); // called by prepare(), under the read lock of the graph
 
 public:
 
     explicit SimpleEvaluator(std::shared_ptr<SimpleGraph> &g);
-    ~SimpleEvaluator() = default;
+    ~SimpleEvaluator();
 
     void prepare() override ;
     cardStat evaluate(RPQTree *query) override ;
+    std::unique_ptr<ResultCursor> open(RPQTree *query, uint64_t limit = 0);
     void planQuery(RPQTree *q);
+    bool reduceChain();
     std::vector<uint32_t> findBestPlan(std::vector<std::pair<uint32_t, cardStat>> query);
+    cardStat estimateJoin(const cardStat &left, const cardStat &right) const;
+    void setReplanThreshold(double qError);
+    size_t getNoArenaAllocations() const;
+    void setMemoryBudget(size_t bytes, const std::string &spillDirectory = "/tmp");
+    void setMemoryLimit(size_t bytes);
+    size_t getPeakMemory() const;
+    size_t getCurrentMemory() const;
+    size_t getGraphMemory() const;
+    bool spilledForLimit() const;
+    void setFactorizeThreshold(double ratio);
+    size_t getNoFactorizedJoins() const;
+
+    // materialized views, picked from the query paths of a workload and built by prepare()
+    void useViews(std::vector<std::string> workload, size_t budgetBytes, const std::string &viewFile = "");
+    std::shared_ptr<ViewCatalog> getViews() const;
+    size_t getNoViewHits() const;
+
+    // closure checks between two given vertices, answered by an index built per label on its
+    // first check, within a limit per label and a total one
+    void setReachabilityLimit(size_t bytesPerLabel, size_t totalBytes);
+    bool reachable(uint32_t source, uint32_t target, uint32_t label, bool inverse);
+    const ReachabilityIndex *getReachabilityIndex() const;
 
     void attachEstimator(std::shared_ptr<SimpleEstimator> &e);
 
-    std::shared_ptr<SimpleGraph> evaluate_aux(RPQTree *q);
-    static std::shared_ptr<SimpleGraph> project(uint32_t label, bool inverse, std::shared_ptr<SimpleGraph> &g);
-    static std::shared_ptr<SimpleGraph> join(std::shared_ptr<SimpleGraph> &left, std::shared_ptr<SimpleGraph> &right);
-
-    static cardStat computeStats(std::shared_ptr<SimpleGraph> &g);
+    std::shared_ptr<HybridRelation> evaluate_aux(RPQTree *q);
+    static std::shared_ptr<HybridRelation> project(uint32_t label, bool inverse, std::shared_ptr<SimpleGraph> &g,
+                                                   std::shared_ptr<QueryArena> &arena,
+                                                   const uint64_t *sourceFilter = nullptr, const uint64_t *targetFilter = nullptr);
+    static std::shared_ptr<HybridRelation> join(std::shared_ptr<HybridRelation> &left, std::shared_ptr<HybridRelation> &right);
+
+    JoinInput makeInput(RPQTree *q);
+    JoinInput chainInput(uint32_t position);
+    std::shared_ptr<HybridRelation> materialize(JoinInput &in);
+    JoinAlgorithm chooseJoin(const JoinInput &left, const JoinInput &right) const;
+    double probeDegree(const JoinInput &probed, bool backward) const;
+    bool probesGraph(const JoinInput &driver, const JoinInput &probed, bool backward) const;
+    JoinInput join(JoinInput &left, JoinInput &right, JoinAlgorithm algorithm);
+
+    JoinInput forwardProbe(JoinInput &left, JoinInput &right);
+    JoinInput externalMergeJoin(JoinInput &left, JoinInput &right);
+    bool shouldFactorize(JoinInput &left, JoinInput &right);
+    JoinInput factorize(JoinInput &left, JoinInput &right);
+    JoinInput factorizedJoin(JoinInput &left, JoinInput &right);
+    std::shared_ptr<HybridRelation> backwardProbe(JoinInput &left, JoinInput &right);
+    std::shared_ptr<HybridRelation> hashJoin(JoinInput &left, JoinInput &right);
+    std::shared_ptr<HybridRelation> sortMergeJoin(JoinInput &left, JoinInput &right);
+
+    static cardStat computeStats(std::shared_ptr<HybridRelation> &r);
+    static cardStat computeStats(std::shared_ptr<SpilledRelation> &r);
+    static cardStat computeStats(JoinInput &in);
 
 private:
     std::vector<std::vector<std::string>> getAllSubsets(std::vector<std::string> plan);
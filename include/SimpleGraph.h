@@ -5,27 +5,83 @@
 #ifndef QS_SIMPLEGRAPH_H
 #define QS_SIMPLEGRAPH_H
 
+#include <algorithm>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
 #include <iostream>
 #include <regex>
 #include <fstream>
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
 #include "Graph.h"
 
+// one staged edge change
+struct EdgeUpdate {
+    uint32_t from;
+    uint32_t to;
+    uint32_t label;
+    bool insert; // false deletes one occurrence of the edge
+};
+
+// effect of merging a batch of staged updates, per label and over all labels
+struct GraphDelta {
+    std::vector<int64_t> edges;     // change in the number of edges
+    std::vector<int64_t> sources;   // change in the number of vertices with an outgoing edge
+    std::vector<int64_t> targets;   // change in the number of vertices with an incoming edge
+    int64_t anySources = 0;         // the same, regardless of the label
+    int64_t anyTargets = 0;
+};
+
+// the edges of one label within an adjacency row
+struct LabelRange {
+    const std::pair<uint32_t,uint32_t> *first;
+    const std::pair<uint32_t,uint32_t> *last;
+
+    size_t size() const { return last - first; }
+    bool empty() const { return first == last; }
+};
+
 class SimpleGraph : public Graph {
 public:
-    //beginpoint-label-endpoint
+    //beginpoint-label-endpoint, every row sorted on (label, target)
     std::vector<std::vector<std::pair<uint32_t,uint32_t>>> adj;
     std::vector<std::vector<std::pair<uint32_t,uint32_t>>> reverse_adj; // vertex adjacency list
 protected:
     uint32_t V;
     uint32_t L;
 
+    // queries read under a shared lock, merging the delta store takes it exclusively
+    mutable std::shared_timed_mutex snapshot_mutex;
+
+    // staged updates, not visible to queries until they are merged
+    std::mutex delta_mutex;
+    std::vector<EdgeUpdate> delta;
+
+    // one merge at a time, from taking the batch to notifying the listeners, so batches are
+    // applied in the order they were staged
+    std::mutex merge_mutex;
+
+    std::mutex listener_mutex;
+    std::vector<std::pair<size_t, std::function<void(const GraphDelta &)>>> listeners;
+    size_t next_listener;
+
+    std::thread merger;
+    std::mutex merger_mutex;
+    std::condition_variable merger_wakeup;
+    bool merger_running;
+
+    void readContiguousFile(const std::string &fileName, const std::function<void(uint32_t, uint32_t, uint32_t)> &edge);
+    void checkEdge(uint32_t from, uint32_t to, uint32_t edgeLabel) const;
+
 public:
 
-    SimpleGraph() : V(0), L(0) {};
-    ~SimpleGraph() = default;
+    SimpleGraph() : V(0), L(0), next_listener(0), merger_running(false) {};
+    ~SimpleGraph();
     explicit SimpleGraph(uint32_t n);
 
     uint32_t getNoVertices() const override ;
@@ -33,12 +89,56 @@ public:
     uint32_t getNoDistinctEdges() const override ;
     uint32_t getNoLabels() const override ;
 
+    // bytes held by the adjacency lists, capacity included
+    size_t getMemoryUsage() const;
+
+    // keeps both rows sorted with an insert, O(degree) per edge: for small graphs and single
+    // edges. bulk builders append every edge and sort the rows once at the end
     void addEdge(uint32_t from, uint32_t to, uint32_t edgeLabel) override ;
+    void appendEdge(uint32_t from, uint32_t to, uint32_t edgeLabel);
+    void sortRows();
+
     void readFromContiguousFile(const std::string &fileName) override ;
 
+    // partitioned loading: the vertices are hash-partitioned over noShards shards and only the
+    // out-edges of the owned sources (adj) and the in-edges of the owned targets (reverse_adj)
+    // of one shard are kept
+    void readShardFromContiguousFile(const std::string &fileName, uint32_t shard, uint32_t noShards);
+    static uint32_t shardOf(uint32_t vertex, uint32_t noShards);
+
+    // the edges of the label in a row: a scan of short rows, a binary search of long ones
+    static LabelRange labelRange(const std::vector<std::pair<uint32_t,uint32_t>> &row, uint32_t label) {
+        const std::pair<uint32_t,uint32_t> *first = row.data(), *end = row.data() + row.size();
+        if(row.size() <= 16) {
+            while(first != end && first->first < label) ++first;
+        } else {
+            first = std::lower_bound(first, end, label, [](const std::pair<uint32_t,uint32_t> &edge, uint32_t l) {
+                return edge.first < l;
+            });
+        }
+        auto last = first;
+        while(last != end && last->first == label) ++last;
+        return LabelRange {first, last};
+    }
+
     void setNoVertices(uint32_t n);
     void setNoLabels(uint32_t noLabels);
 
+    // incremental updates: batches are staged in the delta store and become visible at once
+    // when it is merged, either explicitly or by the background merger
+    void stageUpdates(const std::vector<EdgeUpdate> &batch);
+    size_t getNoStagedUpdates();
+    GraphDelta mergeDelta();
+    void startBackgroundMerge(std::chrono::milliseconds interval);
+    void stopBackgroundMerge();
+
+    // holding this keeps the adjacency lists unchanged (a consistent snapshot)
+    std::shared_lock<std::shared_timed_mutex> readLock() const;
+
+    // called with the effect of every merge, while the graph is still locked exclusively
+    size_t addDeltaListener(std::function<void(const GraphDelta &)> listener);
+    void removeDeltaListener(size_t id);
+
 };
 
 #endif //QS_SIMPLEGRAPH_H
\ No newline at end of file
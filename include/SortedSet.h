@@ -0,0 +1,37 @@
+#ifndef QS_SORTEDSET_H
+#define QS_SORTEDSET_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// kernels over sorted uint32 vertex sets. the functions in the top-level namespace pick
+// the widest implementation the CPU supports (AVX2, SSE4.1, scalar) on first use, the
+// scalar versions are exposed as the reference for the kernel benchmark.
+namespace sortedset {
+
+    // union of two sorted, distinct sets; out needs room for na + nb values. returns the size.
+    size_t unite(const uint32_t *a, size_t na, const uint32_t *b, size_t nb, uint32_t *out);
+
+    // intersection of two sorted, distinct sets; out needs room for min(na, nb) values.
+    size_t intersect(const uint32_t *a, size_t na, const uint32_t *b, size_t nb, uint32_t *out);
+
+    // removes the duplicates of a sorted array in place, returns the new size.
+    size_t dedup(uint32_t *a, size_t n);
+
+    // union of k sorted, distinct sets (pairwise merge tree), the result replaces out.
+    void kWayMerge(const std::vector<std::pair<const uint32_t *, size_t>> &lists, std::vector<uint32_t> &out);
+
+    // name of the implementation the dispatcher picked
+    const char *implementation();
+
+    namespace scalar {
+        size_t unite(const uint32_t *a, size_t na, const uint32_t *b, size_t nb, uint32_t *out);
+        size_t intersect(const uint32_t *a, size_t na, const uint32_t *b, size_t nb, uint32_t *out);
+        size_t dedup(uint32_t *a, size_t n);
+        void kWayMerge(const std::vector<std::pair<const uint32_t *, size_t>> &lists, std::vector<uint32_t> &out);
+    }
+
+}
+
+#endif //QS_SORTEDSET_H
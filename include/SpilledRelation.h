@@ -0,0 +1,174 @@
+#ifndef QS_SPILLEDRELATION_H
+#define QS_SPILLEDRELATION_H
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+#include "HybridRelation.h"
+#include "QueryArena.h"
+
+// relation kept on local disk as sorted run files of (source << 32 | target) keys. each run
+// is sorted and distinct on its own, runs may overlap; reading goes through a k-way merge.
+// a cursor over the relation splits the read budget over the runs and charges it to the arena.
+class SpilledRelation {
+
+    uint32_t V;
+    std::vector<std::string> runs;
+    std::shared_ptr<QueryArena> arena;
+    size_t read_bytes; // read buffers of one cursor, over all runs
+
+public:
+
+    SpilledRelation(uint32_t n, std::vector<std::string> runFiles, std::shared_ptr<QueryArena> a, size_t readBytes);
+    ~SpilledRelation(); // removes the run files
+
+    SpilledRelation(const SpilledRelation &) = delete;
+    SpilledRelation &operator=(const SpilledRelation &) = delete;
+
+    uint32_t getNoVertices() const { return V; }
+    const std::vector<std::string> &getRuns() const { return runs; }
+    const std::shared_ptr<QueryArena> &getArena() const { return arena; }
+    size_t getReadBytes() const { return read_bytes; }
+
+    // calls f(source, targets, card) for every non-empty row in ascending source order, each
+    // row streamed back from the runs into row
+    template <typename F>
+    void forEachRow(std::vector<uint32_t> &row, F f) const;
+
+};
+
+// streams the distinct keys of a spilled relation in ascending order
+class PairCursor {
+
+    struct Run {
+        FILE *file;
+        std::vector<uint64_t> buffer;
+        size_t position;
+        size_t size;
+    };
+
+    std::shared_ptr<QueryArena> arena;
+    std::vector<Run> runs;
+    std::vector<std::pair<uint64_t, size_t>> heap; // (key, run), min-heap
+    bool has_last;
+    uint64_t last;
+    size_t tracked_bytes;
+
+    bool refill(Run &run);
+    void push(size_t run);
+    void pop();
+    void skipDuplicates();
+
+public:
+
+    explicit PairCursor(const SpilledRelation &relation);
+    ~PairCursor();
+
+    PairCursor(const PairCursor &) = delete;
+    PairCursor &operator=(const PairCursor &) = delete;
+
+    bool next(uint64_t &key);
+
+    // all targets of the next source, in ascending order
+    bool nextRow(uint32_t &source, std::vector<uint32_t> &targets);
+
+};
+
+template <typename F>
+void SpilledRelation::forEachRow(std::vector<uint32_t> &row, F f) const {
+    PairCursor cursor(*this);
+    uint32_t source;
+    while(cursor.nextRow(source, row)) f(source, row.data(), row.size());
+}
+
+// collects keys in a memory-bounded buffer and writes them out as sorted, distinct runs. the
+// buffer is deduplicated in place when it fills and only written once that frees less than
+// half of it. keys that already arrive in ascending order and distinct (addSorted) skip all of
+// that and stream into one run until endRun(). runs are merged in tiers as they pile up,
+// fan_in runs of one tier into a run of the next, so the number of runs stays bounded and a
+// cursor over the result opens at most fan_in of them. half of the budget is the buffer, a
+// quarter reads the runs of a merge; all of it is charged to the arena.
+class RunWriter {
+
+    struct Run {
+        std::string path;
+        uint32_t tier;
+    };
+
+    std::string directory;
+    std::shared_ptr<QueryArena> arena;
+    size_t budget;
+    size_t capacity; // keys in the buffer
+    size_t fan_in;
+    std::vector<uint64_t> buffer;
+    std::vector<Run> runs;
+    FILE *sorted_run; // the run addSorted() streams into, nullptr when none is open
+
+    void compact();
+    void flush();
+    void openRun();
+    void writeSorted();
+    void mergeTier();
+    void mergeTail(size_t n);
+
+public:
+
+    RunWriter(std::string spillDirectory, size_t budgetBytes, std::shared_ptr<QueryArena> a);
+    ~RunWriter(); // removes the runs of an unfinished writer
+
+    RunWriter(const RunWriter &) = delete;
+    RunWriter &operator=(const RunWriter &) = delete;
+
+    void add(uint64_t key) {
+        buffer.push_back(key);
+        if(buffer.size() >= capacity) compact();
+    }
+
+    // a key larger than every key since the last endRun(), not mixed with add()
+    void addSorted(uint64_t key) {
+        if(sorted_run == nullptr) openRun();
+        buffer.push_back(key);
+        if(buffer.size() >= capacity) writeSorted();
+    }
+    void endRun();
+
+    std::shared_ptr<SpilledRelation> finish(uint32_t n);
+
+};
+
+// receives the rows of a join result in ascending source order. rows stay in an in-memory
+// relation until that relation takes more than the budget; from then on the rows built so
+// far and every later row go to sorted run files. a budget of 0 never spills.
+class RowSink {
+
+    uint32_t V;
+    std::shared_ptr<QueryArena> arena;
+    size_t budget;
+    std::string directory;
+    std::shared_ptr<HybridRelation> relation;
+    std::unique_ptr<RunWriter> writer;
+    std::shared_ptr<SpilledRelation> spilled;
+
+    void spill();
+
+public:
+
+    RowSink(uint32_t n, std::shared_ptr<QueryArena> a, size_t budgetBytes = 0, std::string spillDirectory = "");
+
+    size_t getNoWords() const { return bitmap::noWords(V); }
+    bool shouldBeDense(uint64_t card) const { return card * 32 > V; }
+
+    void setRow(uint32_t source, const uint32_t *targets, uint32_t card);
+    void setRow(uint32_t source, const uint64_t *bits, uint32_t card);
+
+    // exactly one of the two is set after finish()
+    void finish();
+    std::shared_ptr<HybridRelation> getRelation() const { return relation; }
+    std::shared_ptr<SpilledRelation> getSpilled() const { return spilled; }
+
+};
+
+
+#endif //QS_SPILLEDRELATION_H
@@ -0,0 +1,65 @@
+#ifndef QS_VIEWCATALOG_H
+#define QS_VIEWCATALOG_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Estimator.h"
+#include "HybridRelation.h"
+#include "QueryArena.h"
+#include "SimpleGraph.h"
+
+// a chain of labels, (label, inverse) from left to right
+typedef std::vector<std::pair<uint32_t, bool>> LabelPath;
+
+struct MaterializedView {
+    LabelPath path;
+    std::shared_ptr<HybridRelation> relation;
+    cardStat stats; // exact
+};
+
+// materialized views of label sub-paths that occur often in a query workload. the evaluator
+// picks and computes them in prepare() and rewrites every chain that contains one of them to
+// read the view instead of joining its labels again. the views live in an arena of their own,
+// within a storage budget, and can be saved next to the graph so a restart only loads them.
+class ViewCatalog {
+
+    std::shared_ptr<QueryArena> arena;
+    std::vector<MaterializedView> views;
+    size_t budget; // bytes
+    size_t used_bytes;
+
+public:
+
+    explicit ViewCatalog(size_t budgetBytes);
+
+    static LabelPath parsePath(const std::string &path);
+    static std::string toString(const LabelPath &path);
+
+    // every sub-path of 2 to 3 labels in the workload, with the number of queries it occurs in
+    static std::vector<std::pair<LabelPath, uint64_t>> analyze(const std::vector<std::string> &queryPaths);
+
+    // copies the relation into the catalog, false when it does not fit into the budget
+    bool add(const LabelPath &path, const HybridRelation &relation, const cardStat &stats);
+
+    // the longest view over the labels of the chain that start at position, nullptr for none
+    const MaterializedView *match(const LabelPath &chain, size_t position) const;
+
+    // the file is tied to the graph by its sizes and a hash of its adjacency lists, and to the
+    // workload and budget the views were picked for. load() rejects a file when any of them
+    // differ, or when a row is out of the bounds of the graph
+    void save(const std::string &fileName, const SimpleGraph &graph, const std::vector<std::string> &workload) const;
+    bool load(const std::string &fileName, const SimpleGraph &graph, const std::vector<std::string> &workload);
+
+    void clear();
+
+    size_t getNoViews() const { return views.size(); }
+    size_t getUsedBytes() const { return used_bytes; }
+    size_t getBudget() const { return budget; }
+    const std::shared_ptr<QueryArena> &getArena() const { return arena; }
+
+};
+
+
+#endif //QS_VIEWCATALOG_H
@@ -0,0 +1,68 @@
+#include "Bitmap.h"
+#include "CpuFeatures.h"
+
+#if QS_X86_DISPATCH
+#include <immintrin.h>
+#endif
+
+namespace {
+
+    void orIntoScalar(uint64_t *dst, const uint64_t *src, size_t words) {
+        for(size_t w = 0; w < words; w++) dst[w] |= src[w];
+    }
+
+    uint64_t popcountScalar(const uint64_t *bits, size_t words) {
+        uint64_t sum = 0;
+        for(size_t w = 0; w < words; w++) sum += __builtin_popcountll(bits[w]);
+        return sum;
+    }
+
+#if QS_X86_DISPATCH
+    QS_TARGET("avx2")
+    void orIntoAVX2(uint64_t *dst, const uint64_t *src, size_t words) {
+        size_t w = 0;
+        for(; w + 4 <= words; w += 4) {
+            __m256i a = _mm256_loadu_si256((const __m256i *) (dst + w));
+            __m256i b = _mm256_loadu_si256((const __m256i *) (src + w));
+            _mm256_storeu_si256((__m256i *) (dst + w), _mm256_or_si256(a, b));
+        }
+        for(; w < words; w++) dst[w] |= src[w];
+    }
+
+    QS_TARGET("popcnt")
+    uint64_t popcountHW(const uint64_t *bits, size_t words) {
+        // four independent accumulators to hide the popcnt latency
+        uint64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+        size_t w = 0;
+        for(; w + 4 <= words; w += 4) {
+            s0 += _mm_popcnt_u64(bits[w]);
+            s1 += _mm_popcnt_u64(bits[w + 1]);
+            s2 += _mm_popcnt_u64(bits[w + 2]);
+            s3 += _mm_popcnt_u64(bits[w + 3]);
+        }
+        for(; w < words; w++) s0 += _mm_popcnt_u64(bits[w]);
+        return s0 + s1 + s2 + s3;
+    }
+#endif
+
+}
+
+void bitmap::orInto(uint64_t *dst, const uint64_t *src, size_t words) {
+#if QS_X86_DISPATCH
+    if(cpu::hasAVX2()) return orIntoAVX2(dst, src, words);
+#endif
+    orIntoScalar(dst, src, words);
+}
+
+uint64_t bitmap::popcount(const uint64_t *bits, size_t words) {
+#if QS_X86_DISPATCH
+    if(cpu::hasPopcnt()) return popcountHW(bits, words);
+#endif
+    return popcountScalar(bits, words);
+}
+
+size_t bitmap::extract(const uint64_t *bits, size_t words, uint32_t *out) {
+    size_t n = 0;
+    forEach(bits, words, [&](uint32_t i) { out[n++] = i; });
+    return n;
+}
@@ -0,0 +1,208 @@
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "Exchange.h"
+
+void channel::send(int fd, const void *data, size_t bytes) {
+
+    auto p = static_cast<const char *>(data);
+    while(bytes > 0) {
+        ssize_t n = ::send(fd, p, bytes, MSG_NOSIGNAL);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) throw std::runtime_error(std::string("Channel send failed: ") + std::strerror(errno));
+        p += n;
+        bytes -= n;
+    }
+}
+
+void channel::receive(int fd, void *data, size_t bytes) {
+
+    auto p = static_cast<char *>(data);
+    while(bytes > 0) {
+        ssize_t n = ::recv(fd, p, bytes, 0);
+        if(n < 0 && errno == EINTR) continue;
+        if(n == 0) throw std::runtime_error("Channel closed by the other side");
+        if(n < 0) throw std::runtime_error(std::string("Channel receive failed: ") + std::strerror(errno));
+        p += n;
+        bytes -= n;
+    }
+}
+
+void channel::sendString(int fd, const std::string &s) {
+    uint64_t size = s.size();
+    send(fd, &size, sizeof(size));
+    send(fd, s.data(), s.size());
+}
+
+std::string channel::receiveString(int fd) {
+    uint64_t size;
+    receive(fd, &size, sizeof(size));
+    std::string s(size, '\0');
+    receive(fd, &s[0], size);
+    return s;
+}
+
+void channel::sendKeys(int fd, const std::vector<uint32_t> &keys) {
+    uint64_t size = keys.size();
+    send(fd, &size, sizeof(size));
+    send(fd, keys.data(), keys.size() * sizeof(uint32_t));
+}
+
+std::vector<uint32_t> channel::receiveKeys(int fd) {
+    uint64_t size;
+    receive(fd, &size, sizeof(size));
+    std::vector<uint32_t> keys(size);
+    receive(fd, keys.data(), size * sizeof(uint32_t));
+    return keys;
+}
+
+namespace {
+    // in place of the key count, marks a message from a worker that aborts the round
+    const uint64_t abortMessage = UINT64_MAX;
+}
+
+Exchange::Exchange(uint32_t r, std::vector<int> p) : rank(r), peers(std::move(p)), sent_keys(0), broken(false) {
+    for(auto fd : peers) {
+        if(fd >= 0) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+}
+
+Exchange::~Exchange() {
+    for(auto fd : peers) {
+        if(fd >= 0) close(fd);
+    }
+}
+
+void Exchange::breakLinks() {
+    // the peers see the end of their streams, fail their round and break their links in turn
+    for(auto fd : peers) {
+        if(fd >= 0) ::shutdown(fd, SHUT_RDWR);
+    }
+    broken = true;
+}
+
+std::vector<uint64_t> Exchange::allToAll(std::vector<std::vector<uint64_t>> &outgoing) {
+    return round(outgoing, false);
+}
+
+void Exchange::abort() {
+    if(broken) return;
+    std::vector<std::vector<uint64_t>> none(peers.size());
+    round(none, true);
+}
+
+std::vector<uint64_t> Exchange::round(std::vector<std::vector<uint64_t>> &outgoing, bool abort) {
+
+    if(broken) throw ExchangeAborted("Exchange is down after an earlier failure");
+
+    auto noPeers = (uint32_t) peers.size();
+
+    // a message is its key count followed by the keys
+    struct Transfer {
+        std::vector<uint64_t> message;
+        size_t bytes; // done so far
+    };
+    std::vector<Transfer> sends(noPeers), receives(noPeers);
+    uint32_t pending = 0;
+    uint32_t abortedBy = noPeers;
+
+    for(uint32_t r = 0; r < noPeers; r++) {
+        if(r == rank) continue;
+        if(abort) {
+            sends[r].message.push_back(abortMessage);
+        } else {
+            sends[r].message.reserve(outgoing[r].size() + 1);
+            sends[r].message.push_back(outgoing[r].size());
+            sends[r].message.insert(sends[r].message.end(), outgoing[r].begin(), outgoing[r].end());
+            sent_keys += outgoing[r].size();
+            std::vector<uint64_t>().swap(outgoing[r]);
+        }
+        sends[r].bytes = 0;
+
+        receives[r].message.resize(1);
+        receives[r].bytes = 0;
+        pending += 2;
+    }
+
+    try {
+        std::vector<pollfd> fds;
+        while(pending > 0) {
+
+            fds.clear();
+            for(uint32_t r = 0; r < noPeers; r++) {
+                if(r == rank) continue;
+                short events = 0;
+                if(sends[r].bytes < sends[r].message.size() * sizeof(uint64_t)) events |= POLLOUT;
+                if(receives[r].bytes < receives[r].message.size() * sizeof(uint64_t)) events |= POLLIN;
+                if(events != 0) fds.push_back(pollfd {peers[r], events, 0});
+            }
+
+            if(poll(fds.data(), fds.size(), -1) < 0) {
+                if(errno == EINTR) continue;
+                throw std::runtime_error(std::string("Exchange poll failed: ") + std::strerror(errno));
+            }
+
+            for(auto &pfd : fds) {
+                uint32_t r = 0;
+                while(peers[r] != pfd.fd) r++;
+
+                if(pfd.revents & POLLOUT) {
+                    auto &t = sends[r];
+                    size_t total = t.message.size() * sizeof(uint64_t);
+                    ssize_t n = ::send(pfd.fd, reinterpret_cast<char *>(t.message.data()) + t.bytes, total - t.bytes, MSG_NOSIGNAL);
+                    if(n < 0 && errno != EAGAIN && errno != EINTR)
+                        throw std::runtime_error(std::string("Exchange send failed: ") + std::strerror(errno));
+                    if(n > 0 && (t.bytes += n) == total) {
+                        std::vector<uint64_t>().swap(t.message);
+                        t.bytes = 0;
+                        pending--;
+                    }
+                }
+
+                // a hangup with nothing left to read is a peer that dropped out of the round
+                if(pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+                    auto &t = receives[r];
+                    size_t total = t.message.size() * sizeof(uint64_t);
+                    if(t.bytes == total) throw std::runtime_error("Exchange peer " + std::to_string(r) + " went away");
+                    ssize_t n = ::recv(pfd.fd, reinterpret_cast<char *>(t.message.data()) + t.bytes, total - t.bytes, 0);
+                    if(n == 0) throw std::runtime_error("Exchange peer " + std::to_string(r) + " went away");
+                    if(n < 0 && errno != EAGAIN && errno != EINTR)
+                        throw std::runtime_error(std::string("Exchange receive failed: ") + std::strerror(errno));
+                    if(n > 0) t.bytes += n;
+
+                    // the count arrived, size the buffer for the keys behind it
+                    bool counted = t.bytes == sizeof(uint64_t) && t.message.size() == 1;
+                    if(counted && t.message[0] == abortMessage) {
+                        t.message[0] = 0;
+                        abortedBy = r;
+                        pending--;
+                    } else if(counted && t.message[0] > 0) {
+                        t.message.resize(1 + t.message[0]);
+                    } else if(t.bytes == t.message.size() * sizeof(uint64_t)) {
+                        pending--;
+                    }
+                }
+            }
+        }
+    } catch(std::exception &e) {
+        breakLinks();
+        throw ExchangeAborted(e.what());
+    }
+
+    // the round is complete on every link, so the streams stay in step for the next query
+    if(abort) return std::vector<uint64_t>();
+    if(abortedBy < noPeers) throw ExchangeAborted("Exchange aborted by worker " + std::to_string(abortedBy));
+
+    std::vector<uint64_t> incoming = std::move(outgoing[rank]);
+    outgoing[rank].clear();
+    for(uint32_t r = 0; r < noPeers; r++) {
+        if(r == rank) continue;
+        incoming.insert(incoming.end(), receives[r].message.begin() + 1, receives[r].message.end());
+    }
+
+    return incoming;
+}
@@ -0,0 +1,93 @@
+#include <unordered_map>
+#include <vector>
+#include "FactorizedRelation.h"
+#include "SortedSet.h"
+
+FactorizedRelation::FactorizedRelation(std::shared_ptr<HybridRelation> sourcesByVertex,
+                                       std::shared_ptr<HybridRelation> targetsByVertex)
+        : sources(std::move(sourcesByVertex)), targets(std::move(targetsByVertex)) {}
+
+cardStat FactorizedRelation::count() const {
+
+    cardStat stats {};
+    uint32_t noVertices = getNoVertices();
+    size_t words = sources->getNoWords();
+
+    // only the products with both sides non-empty contribute
+    std::vector<uint64_t> sourceBits(words, 0), targetBits(words, 0);
+    sources->getArena()->track(2 * words * sizeof(uint64_t));
+    for(uint32_t v = 0; v < noVertices; v++) {
+        if(sources->getRowSize(v) == 0 || targets->getRowSize(v) == 0) continue;
+        sources->unionInto(v, sourceBits.data());
+        targets->unionInto(v, targetBits.data());
+    }
+    stats.noOut = (uint32_t) bitmap::popcount(sourceBits.data(), words);
+    stats.noIn = (uint32_t) bitmap::popcount(targetBits.data(), words);
+    sources->getArena()->untrack(2 * words * sizeof(uint64_t));
+
+    // group the sources by their signature, the join vertices whose products they are in
+    auto bySource = sources->transpose();
+    std::unordered_map<uint64_t, std::vector<uint32_t>> groupsByHash;
+    std::vector<std::vector<uint32_t>> signatures;
+    std::vector<uint64_t> groupSizes;
+    std::vector<uint32_t> signature;
+
+    for(uint32_t source = 0; source < noVertices; source++) {
+        if(bySource->getRowSize(source) == 0) continue;
+
+        signature.clear();
+        bySource->forEachTarget(source, [&](uint32_t v) {
+            if(targets->getRowSize(v) > 0) signature.push_back(v);
+        });
+        if(signature.empty()) continue;
+
+        uint64_t hash = 14695981039346656037ull; // fnv-1a over the vertex ids
+        for(auto v : signature) hash = (hash ^ v) * 1099511628211ull;
+
+        auto &ids = groupsByHash[hash];
+        uint32_t group = 0;
+        while(group < ids.size() && signatures[ids[group]] != signature) group++;
+        if(group == ids.size()) {
+            ids.push_back((uint32_t) signatures.size());
+            signatures.push_back(signature);
+            groupSizes.push_back(0);
+        }
+        groupSizes[ids[group]]++;
+    }
+
+    // every source of a group reaches the union of the target sets of its signature
+    std::vector<std::pair<const uint32_t *, size_t>> rows;
+    std::vector<uint32_t> merged;
+    std::vector<uint64_t> bits;
+    uint64_t noPaths = 0;
+
+    for(size_t group = 0; group < signatures.size(); group++) {
+        auto &vertices = signatures[group];
+
+        uint64_t candidates = 0;
+        bool anyDense = false;
+        for(auto v : vertices) {
+            candidates += targets->getRowSize(v);
+            anyDense |= targets->isDense(v);
+        }
+
+        uint64_t card;
+        if(vertices.size() == 1) {
+            card = candidates;
+        } else if(!anyDense && !targets->shouldBeDense(candidates)) {
+            rows.clear();
+            for(auto v : vertices) rows.emplace_back(targets->getTargets(v), targets->getRowSize(v));
+            sortedset::kWayMerge(rows, merged);
+            card = merged.size();
+        } else {
+            bits.assign(words, 0);
+            for(auto v : vertices) targets->unionInto(v, bits.data());
+            card = bitmap::popcount(bits.data(), words);
+        }
+
+        noPaths += groupSizes[group] * card;
+    }
+    stats.noPaths = (uint32_t) std::min<uint64_t>(noPaths, UINT32_MAX);
+
+    return stats;
+}
@@ -0,0 +1,126 @@
+#include <algorithm>
+#include <cstring>
+#include "HybridRelation.h"
+
+HybridRelation::HybridRelation(uint32_t n, std::shared_ptr<QueryArena> arena)
+        : V(n), W(bitmap::noWords(n)), region(std::move(arena)) {
+    cards = region.allocate<uint32_t>(V);
+    payloads = region.allocate<const void *>(V);
+    std::memset(cards, 0, V * sizeof(uint32_t));
+}
+
+void *HybridRelation::reserveRow(uint32_t source, uint32_t card) {
+
+    void *payload;
+    if(shouldBeDense(card)) {
+        payload = region.allocate<uint64_t>(W);
+        std::memset(payload, 0, W * sizeof(uint64_t));
+    } else {
+        payload = region.allocate<uint32_t>(card);
+    }
+
+    cards[source] = card;
+    payloads[source] = payload;
+    return payload;
+}
+
+void HybridRelation::setRow(uint32_t source, const uint32_t *targets, uint32_t card) {
+
+    if(card == 0) {
+        cards[source] = 0;
+        return;
+    }
+
+    void *payload = reserveRow(source, card);
+    if(shouldBeDense(card)) {
+        for(uint32_t i = 0; i < card; i++) bitmap::set(static_cast<uint64_t *>(payload), targets[i]);
+    } else {
+        std::memcpy(payload, targets, card * sizeof(uint32_t));
+    }
+}
+
+void HybridRelation::setRow(uint32_t source, const uint64_t *bits, uint32_t card) {
+
+    if(card == 0) {
+        cards[source] = 0;
+        return;
+    }
+
+    void *payload = reserveRow(source, card);
+    if(shouldBeDense(card)) {
+        std::memcpy(payload, bits, W * sizeof(uint64_t));
+    } else {
+        bitmap::extract(bits, W, static_cast<uint32_t *>(payload));
+    }
+}
+
+size_t HybridRelation::getNoBytes() const {
+
+    size_t bytes = V * (sizeof(uint32_t) + sizeof(const void *));
+    for(uint32_t source = 0; source < V; source++) {
+        if(cards[source] == 0) continue;
+        bytes += isDense(source) ? W * sizeof(uint64_t) : cards[source] * sizeof(uint32_t);
+    }
+
+    return bytes;
+}
+
+void HybridRelation::unionInto(uint32_t source, uint64_t *bits) const {
+
+    uint32_t card = cards[source];
+    if(card == 0) return;
+
+    if(shouldBeDense(card)) bitmap::orInto(bits, getBits(source), W);
+    else for(const uint32_t *t = getTargets(source), *end = t + card; t != end; ++t) bitmap::set(bits, *t);
+}
+
+std::shared_ptr<HybridRelation> HybridRelation::transpose() const {
+
+    auto out = std::make_shared<HybridRelation>(V, getArena());
+
+    // count first, then reserve every transposed row at its exact size and fill it
+    size_t scratchBytes = (size_t) V * (sizeof(uint32_t) + sizeof(uint32_t *));
+    getArena()->track(scratchBytes);
+    std::vector<uint32_t> inDegree(V, 0);
+    for(uint32_t source = 0; source < V; source++) {
+        forEachTarget(source, [&](uint32_t target) { inDegree[target]++; });
+    }
+
+    std::vector<uint32_t *> fill(V, nullptr);
+    for(uint32_t target = 0; target < V; target++) {
+        if(inDegree[target] > 0) fill[target] = static_cast<uint32_t *>(out->reserveRow(target, inDegree[target]));
+    }
+
+    // sources are visited in ascending order, so the sparse rows come out sorted
+    for(uint32_t source = 0; source < V; source++) {
+        forEachTarget(source, [&](uint32_t target) {
+            if(out->shouldBeDense(inDegree[target])) bitmap::set(reinterpret_cast<uint64_t *>(fill[target]), source);
+            else *fill[target]++ = source;
+        });
+    }
+
+    getArena()->untrack(scratchBytes);
+    return out;
+}
+
+std::shared_ptr<HybridRelation> HybridRelation::fromPairs(uint32_t n, std::vector<uint64_t> &pairs,
+                                                          std::shared_ptr<QueryArena> arena) {
+
+    auto out = std::make_shared<HybridRelation>(n, std::move(arena));
+
+    std::sort(pairs.begin(), pairs.end());
+    pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+
+    std::vector<uint32_t> targets;
+    size_t i = 0;
+    while(i < pairs.size()) {
+        auto source = (uint32_t) (pairs[i] >> 32);
+        targets.clear();
+        for(; i < pairs.size() && (uint32_t) (pairs[i] >> 32) == source; i++) {
+            targets.push_back((uint32_t) pairs[i]);
+        }
+        out->setRow(source, targets);
+    }
+
+    return out;
+}
@@ -0,0 +1,270 @@
+#include <algorithm>
+#include "OperatorKernels.h"
+#include "Bitmap.h"
+#include "SortedSet.h"
+
+namespace {
+
+    typedef std::vector<std::vector<std::pair<uint32_t,uint32_t>>> Adjacency;
+
+    template <bool Inverse>
+    const Adjacency &adjacencyOf(const SimpleGraph &graph) {
+        return Inverse ? graph.reverse_adj : graph.adj;
+    }
+
+    // copies the targets of a label range into out, which has room for all of them. with a
+    // filter every target is still written, only the ones in it advance the output position
+    template <bool Filtered>
+    size_t copyTargets(LabelRange range, const uint64_t *targetFilter, uint32_t *out) {
+        size_t n = 0;
+        for(auto edge = range.first; edge != range.last; ++edge) {
+            out[n] = edge->second;
+            n += Filtered ? bitmap::test(targetFilter, edge->second) : 1;
+        }
+        return n;
+    }
+
+    // sorts, dedups and stores the collected targets of one output row
+    void emitRow(uint32_t source, std::vector<uint32_t> &targets, size_t count, std::vector<uint64_t> &bits, RowSink &out) {
+
+        if(count == 0) return;
+
+        if(out.shouldBeDense(count)) {
+            bits.assign(out.getNoWords(), 0);
+            for(size_t i = 0; i < count; i++) bitmap::set(bits.data(), targets[i]);
+            out.setRow(source, bits.data(), (uint32_t) bitmap::popcount(bits.data(), bits.size()));
+        } else {
+            std::sort(targets.begin(), targets.begin() + count);
+            out.setRow(source, targets.data(), (uint32_t) sortedset::dedup(targets.data(), count));
+        }
+    }
+
+    // fixed-size columns of (source, middle) pairs, cut from the rows of the left relation
+    struct PairBatch {
+        static const size_t capacity = 1024;
+        size_t size = 0;
+        alignas(64) uint32_t sources[capacity];
+        alignas(64) uint32_t middles[capacity];
+    };
+
+    // the graph side of a forward probe, a batch at a time. the adjacency rows of the pairs a
+    // few positions ahead are prefetched, so their cache misses overlap with the copying of
+    // the current rows instead of stalling one after the other
+    template <bool Inverse, bool Filtered>
+    class BatchProbe {
+
+        static const size_t prefetchDistance = 8;
+
+        const Adjacency &adjacency;
+        uint32_t label;
+        const uint64_t *targetFilter;
+        RowSink &out;
+        PairBatch batch;
+        std::vector<uint32_t> targets;
+        std::vector<uint64_t> bits;
+        uint32_t current; // source of the row being collected
+        size_t noTargets;
+
+        void run() {
+
+            for(size_t i = 0; i < batch.size; i++) {
+                // the vector header first, its row once the header is likely cached
+                if(i + 2 * prefetchDistance < batch.size) __builtin_prefetch(&adjacency[batch.middles[i + 2 * prefetchDistance]]);
+                if(i + prefetchDistance < batch.size) __builtin_prefetch(adjacency[batch.middles[i + prefetchDistance]].data());
+
+                if(batch.sources[i] != current) {
+                    emitRow(current, targets, noTargets, bits, out);
+                    current = batch.sources[i];
+                    noTargets = 0;
+                }
+
+                auto range = SimpleGraph::labelRange(adjacency[batch.middles[i]], label);
+                if(targets.size() < noTargets + range.size()) targets.resize(std::max(2 * targets.size(), noTargets + range.size()));
+                noTargets += copyTargets<Filtered>(range, targetFilter, targets.data() + noTargets);
+            }
+            batch.size = 0;
+        }
+
+    public:
+
+        BatchProbe(const Adjacency &adjacency, uint32_t label, const uint64_t *targetFilter, RowSink &out)
+                : adjacency(adjacency), label(label), targetFilter(targetFilter), out(out),
+                  targets(PairBatch::capacity), current(0), noTargets(0) {}
+
+        void add(uint32_t source, const uint32_t *middles, size_t count) {
+            while(count > 0) {
+                size_t n = std::min(count, PairBatch::capacity - batch.size);
+                std::fill(batch.sources + batch.size, batch.sources + batch.size + n, source);
+                std::copy(middles, middles + n, batch.middles + batch.size);
+                batch.size += n;
+                middles += n;
+                count -= n;
+                if(batch.size == PairBatch::capacity) run();
+            }
+        }
+
+        void finish() {
+            run();
+            emitRow(current, targets, noTargets, bits, out);
+            noTargets = 0;
+        }
+    };
+
+    template <bool Inverse, bool SourceFiltered, bool TargetFiltered>
+    void projectLabel(const SimpleGraph &graph, uint32_t label, const uint64_t *sourceFilter,
+                      const uint64_t *targetFilter, HybridRelation &out) {
+
+        auto &adjacency = adjacencyOf<Inverse>(graph);
+        std::vector<uint32_t> targets;
+
+        for(uint32_t source = 0; source < graph.getNoVertices(); source++) {
+            if(SourceFiltered && !bitmap::test(sourceFilter, source)) continue;
+
+            auto range = SimpleGraph::labelRange(adjacency[source], label);
+            if(range.empty()) continue;
+
+            // the range is sorted on the target already, only repeated edges are left to drop
+            targets.resize(range.size());
+            size_t n = copyTargets<TargetFiltered>(range, targetFilter, targets.data());
+            if(n == 0) continue;
+            out.setRow(source, targets.data(), (uint32_t) sortedset::dedup(targets.data(), n));
+        }
+    }
+
+    template <bool Inverse>
+    cardStat countLabel(const SimpleGraph &graph, uint32_t label) {
+
+        cardStat stats {};
+        auto &adjacency = adjacencyOf<Inverse>(graph);
+        std::vector<uint64_t> in(bitmap::noWords(graph.getNoVertices()), 0);
+
+        for(uint32_t v = 0; v < graph.getNoVertices(); v++) {
+            auto range = SimpleGraph::labelRange(adjacency[v], label);
+            if(range.empty()) continue;
+
+            // distinct targets of a sorted range: the first one, and every change after it
+            uint32_t distinct = 1;
+            bitmap::set(in.data(), range.first->second);
+            for(auto edge = range.first + 1; edge < range.last; ++edge) {
+                distinct += edge->second != edge[-1].second;
+                bitmap::set(in.data(), edge->second);
+            }
+            stats.noOut++;
+            stats.noPaths += distinct;
+        }
+        stats.noIn = (uint32_t) bitmap::popcount(in.data(), in.size());
+
+        return stats;
+    }
+
+    template <bool Inverse, bool Filtered, typename Left>
+    void probeLabel(const SimpleGraph &graph, uint32_t label, const uint64_t *targetFilter, const Left &left, RowSink &out) {
+
+        BatchProbe<Inverse, Filtered> probe(adjacencyOf<Inverse>(graph), label, targetFilter, out);
+        std::vector<uint32_t> row;
+        left.forEachRow(row, [&](uint32_t source, const uint32_t *middles, size_t count) {
+            probe.add(source, middles, count);
+        });
+        probe.finish();
+    }
+
+}
+
+kernels::ProjectKernel kernels::projectKernel(bool inverse, bool sourceFilter, bool targetFilter) {
+    static const ProjectKernel table[2][2][2] = {
+            {{projectLabel<false, false, false>, projectLabel<false, false, true>},
+             {projectLabel<false, true, false>, projectLabel<false, true, true>}},
+            {{projectLabel<true, false, false>, projectLabel<true, false, true>},
+             {projectLabel<true, true, false>, projectLabel<true, true, true>}}
+    };
+    return table[inverse][sourceFilter][targetFilter];
+}
+
+kernels::CountKernel kernels::countKernel(bool inverse) {
+    static const CountKernel table[2] = {countLabel<false>, countLabel<true>};
+    return table[inverse];
+}
+
+template <typename Left>
+kernels::ProbeKernel<Left> kernels::probeKernel(bool inverse, bool targetFilter) {
+    static const ProbeKernel<Left> table[2][2] = {
+            {probeLabel<false, false, Left>, probeLabel<false, true, Left>},
+            {probeLabel<true, false, Left>, probeLabel<true, true, Left>}
+    };
+    return table[inverse][targetFilter];
+}
+
+template kernels::ProbeKernel<HybridRelation> kernels::probeKernel<HybridRelation>(bool, bool);
+template kernels::ProbeKernel<SpilledRelation> kernels::probeKernel<SpilledRelation>(bool, bool);
+
+std::string kernels::describe(bool inverse, bool sourceFilter, bool targetFilter) {
+    std::string s = inverse ? "inverse" : "forward";
+    if(sourceFilter) s += ", source filter";
+    if(targetFilter) s += ", target filter";
+    return s;
+}
+
+void kernels::generic::project(const SimpleGraph &graph, uint32_t label, bool inverse, const uint64_t *sourceFilter,
+                               const uint64_t *targetFilter, HybridRelation &out) {
+
+    auto &adjacency = inverse ? graph.reverse_adj : graph.adj;
+    std::vector<uint32_t> targets;
+
+    for(uint32_t source = 0; source < graph.getNoVertices(); source++) {
+        if(sourceFilter != nullptr && !bitmap::test(sourceFilter, source)) continue;
+
+        targets.clear();
+        for(auto labelTarget : adjacency[source]) {
+            if(labelTarget.first == label && (targetFilter == nullptr || bitmap::test(targetFilter, labelTarget.second)))
+                targets.push_back(labelTarget.second);
+        }
+        if(targets.empty()) continue;
+
+        std::sort(targets.begin(), targets.end());
+        targets.resize(sortedset::dedup(targets.data(), targets.size()));
+        out.setRow(source, targets);
+    }
+}
+
+cardStat kernels::generic::count(const SimpleGraph &graph, uint32_t label, bool inverse) {
+
+    cardStat stats {};
+    auto &adjacency = inverse ? graph.reverse_adj : graph.adj;
+    std::vector<uint64_t> in(bitmap::noWords(graph.getNoVertices()), 0);
+    std::vector<uint32_t> targets;
+
+    for(uint32_t source = 0; source < graph.getNoVertices(); source++) {
+        targets.clear();
+        for(auto labelTarget : adjacency[source]) {
+            if(labelTarget.first == label) targets.push_back(labelTarget.second);
+        }
+        if(targets.empty()) continue;
+
+        std::sort(targets.begin(), targets.end());
+        stats.noOut++;
+        stats.noPaths += (uint32_t) sortedset::dedup(targets.data(), targets.size());
+        for(auto target : targets) bitmap::set(in.data(), target);
+    }
+    stats.noIn = (uint32_t) bitmap::popcount(in.data(), in.size());
+
+    return stats;
+}
+
+void kernels::generic::probe(const SimpleGraph &graph, uint32_t label, bool inverse, const uint64_t *targetFilter,
+                             const HybridRelation &left, RowSink &out) {
+
+    auto &adjacency = inverse ? graph.reverse_adj : graph.adj;
+    std::vector<uint32_t> row, targets;
+    std::vector<uint64_t> bits;
+
+    left.forEachRow(row, [&](uint32_t source, const uint32_t *middles, size_t count) {
+        targets.clear();
+        for(size_t i = 0; i < count; i++) {
+            for(auto labelTarget : adjacency[middles[i]]) {
+                if(labelTarget.first == label && (targetFilter == nullptr || bitmap::test(targetFilter, labelTarget.second)))
+                    targets.push_back(labelTarget.second);
+            }
+        }
+        emitRow(source, targets, targets.size(), bits, out);
+    });
+}
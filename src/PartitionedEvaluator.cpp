@@ -0,0 +1,262 @@
+#include <functional>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "PartitionedEvaluator.h"
+#include "SortedSet.h"
+
+PartitionedEvaluator::PartitionedEvaluator(const std::string &graphFile, uint32_t noWorkers)
+        : no_workers(noWorkers), no_exchanged_pairs(0) {
+
+    if(noWorkers == 0) throw std::runtime_error("Partitioned evaluation needs at least one worker");
+
+    // full mesh between the workers, mesh[i][j] is the end of worker i towards worker j
+    std::vector<std::vector<int>> mesh(noWorkers, std::vector<int>(noWorkers, -1));
+    std::vector<int> workerEnds(noWorkers);
+    int fds[2];
+
+    for(uint32_t i = 0; i < noWorkers; i++) {
+        for(uint32_t j = i + 1; j < noWorkers; j++) {
+            if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) throw std::runtime_error("Cannot create worker sockets");
+            mesh[i][j] = fds[0];
+            mesh[j][i] = fds[1];
+        }
+        if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) throw std::runtime_error("Cannot create worker sockets");
+        channels.push_back(fds[0]);
+        workerEnds[i] = fds[1];
+    }
+
+    // a forked worker must not print what is still buffered here a second time
+    std::cout.flush();
+
+    for(uint32_t rank = 0; rank < noWorkers; rank++) {
+        pid_t pid = fork();
+        if(pid < 0) throw std::runtime_error("Cannot fork worker " + std::to_string(rank));
+
+        if(pid == 0) {
+            // keep only the sockets of this worker
+            for(uint32_t i = 0; i < noWorkers; i++) {
+                close(channels[i]);
+                if(i == rank) continue;
+                close(workerEnds[i]);
+                for(auto fd : mesh[i]) if(fd >= 0) close(fd);
+            }
+
+            int status = 0;
+            try {
+                Exchange exchange(rank, mesh[rank]);
+                runWorker(rank, graphFile, workerEnds[rank], exchange);
+            } catch(std::exception &e) {
+                std::cerr << "Worker " << rank << ": " << e.what() << std::endl;
+                status = 1;
+            }
+            _exit(status);
+        }
+
+        workers.push_back(pid);
+    }
+
+    for(uint32_t i = 0; i < noWorkers; i++) {
+        close(workerEnds[i]);
+        for(auto fd : mesh[i]) if(fd >= 0) close(fd);
+    }
+
+    // every worker reports once its shard is in memory
+    try {
+        for(auto channel : channels) {
+            uint64_t noEdges;
+            channel::receive(channel, &noEdges, sizeof(noEdges));
+        }
+    } catch(std::runtime_error &) {
+        shutdown();
+        throw;
+    }
+}
+
+PartitionedEvaluator::~PartitionedEvaluator() {
+    shutdown();
+}
+
+void PartitionedEvaluator::shutdown() {
+
+    // an empty query stops a worker
+    for(auto channel : channels) {
+        try {
+            channel::sendString(channel, "");
+        } catch(std::runtime_error &) {}
+        close(channel);
+    }
+    channels.clear();
+
+    for(auto pid : workers) waitpid(pid, nullptr, 0);
+    workers.clear();
+}
+
+cardStat PartitionedEvaluator::evaluate(const std::string &path) {
+
+    // a worker that is gone fails the query like one that reports an error, the answers of
+    // the others are still read so their channels stay in step for the next query
+    cardStat stats {};
+    std::string error, abortError; // a failure, or only a peer aborted by one
+    std::vector<bool> asked(no_workers, false);
+    for(uint32_t rank = 0; rank < no_workers; rank++) {
+        try {
+            channel::sendString(channels[rank], path);
+            asked[rank] = true;
+        } catch(std::runtime_error &e) {
+            error = "Worker " + std::to_string(rank) + ": " + e.what();
+        }
+    }
+
+    // (status, noPaths, noIn, exchanged pairs) from every worker, then its distinct sources or
+    // an error message. status 1 is a failure of the worker, 2 an exchange the failure of
+    // another worker aborted
+    std::vector<std::vector<uint32_t>> sources(no_workers);
+    no_exchanged_pairs = 0;
+
+    for(uint32_t rank = 0; rank < no_workers; rank++) {
+        if(!asked[rank]) continue;
+        try {
+            uint64_t header[4];
+            channel::receive(channels[rank], header, sizeof(header));
+            if(header[0] != 0) {
+                (header[0] == 2 ? abortError : error) = channel::receiveString(channels[rank]);
+                continue;
+            }
+
+            // both are counted per end vertex, and every end vertex belongs to one shard only
+            stats.noPaths += (uint32_t) header[1];
+            stats.noIn += (uint32_t) header[2];
+            no_exchanged_pairs += header[3];
+            sources[rank] = channel::receiveKeys(channels[rank]);
+        } catch(std::runtime_error &e) {
+            error = "Worker " + std::to_string(rank) + ": " + e.what();
+        }
+    }
+    if(error.empty()) error = abortError;
+    if(!error.empty()) throw std::runtime_error(error);
+
+    // a source can reach end vertices on several shards, so noOut needs the union
+    std::vector<std::pair<const uint32_t *, size_t>> lists;
+    for(auto &list : sources) {
+        if(!list.empty()) lists.emplace_back(list.data(), list.size());
+    }
+    std::vector<uint32_t> allSources;
+    sortedset::kWayMerge(lists, allSources);
+    stats.noOut = (uint32_t) allSources.size();
+
+    return stats;
+}
+
+void PartitionedEvaluator::runWorker(uint32_t rank, const std::string &graphFile, int channel, Exchange &exchange) {
+
+    auto graph = std::make_shared<SimpleGraph>();
+    graph->readShardFromContiguousFile(graphFile, rank, exchange.getNoPeers());
+
+    uint64_t noEdges = graph->getNoEdges();
+    channel::send(channel, &noEdges, sizeof(noEdges));
+
+    while(true) {
+        std::string path = channel::receiveString(channel);
+        if(path.empty()) return;
+
+        cardStat stats {};
+        std::vector<uint32_t> sources;
+        std::string error;
+        uint64_t status = 0;
+        uint64_t sentBefore = exchange.getNoSentKeys();
+
+        RPQTree *query = RPQTree::strToTree(path);
+        try {
+            stats = evaluateShard(query, graph, exchange, sources);
+        } catch(ExchangeAborted &e) {
+            error = e.what();
+            status = 2;
+        } catch(std::exception &e) {
+            error = e.what();
+            status = 1;
+        }
+        delete(query);
+
+        uint64_t header[4] = {status, stats.noPaths, stats.noIn, exchange.getNoSentKeys() - sentBefore};
+        channel::send(channel, header, sizeof(header));
+        if(error.empty()) channel::sendKeys(channel, sources);
+        else channel::sendString(channel, error);
+    }
+}
+
+cardStat PartitionedEvaluator::evaluateShard(RPQTree *query, std::shared_ptr<SimpleGraph> &graph, Exchange &exchange,
+                                             std::vector<uint32_t> &sources) {
+
+    // the labels of the chain, left to right
+    std::vector<std::pair<uint32_t, bool>> chain;
+    std::regex labelPat (R"((\d+)([+-]))");
+    std::function<void(RPQTree *)> collect = [&](RPQTree *q) {
+        if(q->isLeaf()) {
+            std::smatch matches;
+            if(!std::regex_search(q->data, matches, labelPat))
+                throw std::runtime_error(std::string("Label parsing failed: ") + q->data);
+            chain.emplace_back((uint32_t) std::stoul(matches[1]), matches[2] == "-");
+        } else {
+            collect(q->left);
+            collect(q->right);
+        }
+    };
+    collect(query);
+
+    uint32_t rank = exchange.getRank();
+    uint32_t noShards = exchange.getNoPeers();
+
+    // (source << 32 | vertex) pairs, always on the shard that owns the vertex
+    std::vector<uint64_t> frontier;
+    std::vector<std::vector<uint64_t>> outgoing(noShards);
+
+    for(uint32_t i = 0; i < chain.size(); i++) {
+        uint32_t label = chain[i].first;
+        auto &adjacency = chain[i].second ? graph->reverse_adj : graph->adj;
+
+        auto expand = [&](uint64_t source, uint32_t vertex) {
+            auto range = SimpleGraph::labelRange(adjacency[vertex], label);
+            for(auto edge = range.first; edge != range.last; ++edge)
+                outgoing[SimpleGraph::shardOf(edge->second, noShards)].push_back(source << 32 | edge->second);
+        };
+
+        try {
+            if(i == 0) {
+                for(uint32_t vertex = 0; vertex < graph->getNoVertices(); vertex++) {
+                    if(SimpleGraph::shardOf(vertex, noShards) == rank) expand(vertex, vertex);
+                }
+            } else {
+                for(auto pair : frontier) expand(pair >> 32, (uint32_t) pair);
+            }
+
+            // duplicates are dropped before they go over the wire
+            for(auto &keys : outgoing) {
+                std::sort(keys.begin(), keys.end());
+                keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+            }
+        } catch(std::exception &) {
+            // the other shards are on their way into this round, it aborts them instead of
+            // leaving them waiting for pairs that never come
+            exchange.abort();
+            throw;
+        }
+
+        frontier = exchange.allToAll(outgoing);
+        std::sort(frontier.begin(), frontier.end());
+        frontier.erase(std::unique(frontier.begin(), frontier.end()), frontier.end());
+    }
+
+    // every end vertex here is owned by this shard, so the distinct pairs and end vertices add
+    // up over the shards; the sources go to the coordinator
+    std::vector<uint32_t> targets;
+    for(auto pair : frontier) {
+        sources.push_back((uint32_t) (pair >> 32));
+        targets.push_back((uint32_t) pair);
+    }
+    sources.resize(sortedset::dedup(sources.data(), sources.size())); // sorted already
+    std::sort(targets.begin(), targets.end());
+    targets.resize(sortedset::dedup(targets.data(), targets.size()));
+
+    return cardStat {(uint32_t) sources.size(), (uint32_t) frontier.size(), (uint32_t) targets.size()};
+}
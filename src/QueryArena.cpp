@@ -0,0 +1,125 @@
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include "QueryArena.h"
+
+namespace {
+    const size_t alignment = 32;
+    const size_t firstChunkDivisor = 64; // the first bump chunk of a region, of the arena chunk size
+
+    size_t alignUp(size_t n) {
+        return (n + alignment - 1) & ~(alignment - 1);
+    }
+}
+
+QueryArena::QueryArena(size_t chunkSize)
+        : chunk_size(chunkSize), no_allocations(0), reserved_bytes(0), used_bytes(0), tracked_bytes(0), peak_bytes(0), limit(0) {}
+
+QueryArena::~QueryArena() {
+    release();
+}
+
+QueryArena::Chunk QueryArena::acquire(size_t minBytes) {
+
+    minBytes = alignUp(minBytes);
+    size_t maxBytes = std::max(2 * minBytes, chunk_size);
+
+    // best fit among the pooled chunks that would not waste more than half of themselves
+    size_t best = free_chunks.size();
+    for(size_t i = 0; i < free_chunks.size(); i++) {
+        size_t size = free_chunks[i].size;
+        if(size < minBytes || size > maxBytes) continue;
+        if(best == free_chunks.size() || size < free_chunks[best].size) best = i;
+    }
+
+    if(best < free_chunks.size()) {
+        Chunk chunk = free_chunks[best];
+        free_chunks[best] = free_chunks.back();
+        free_chunks.pop_back();
+        return chunk;
+    }
+
+    void *data = ::aligned_alloc(alignment, minBytes);
+    if(data == nullptr) throw std::bad_alloc();
+
+    no_allocations++;
+    reserved_bytes += minBytes;
+    return Chunk {static_cast<char *>(data), minBytes};
+}
+
+void QueryArena::checkLimit(size_t extraBytes) {
+
+    if(limit > 0 && getCurrentBytes() + extraBytes > limit)
+        throw MemoryLimitExceeded("Query memory limit of " + std::to_string(limit) + " bytes exceeded");
+}
+
+void QueryArena::startQuery() {
+    tracked_bytes = 0;
+    peak_bytes = used_bytes;
+}
+
+void QueryArena::track(size_t bytes) {
+    checkLimit(bytes);
+    tracked_bytes += bytes;
+    peak_bytes = std::max(peak_bytes, getCurrentBytes());
+}
+
+void QueryArena::untrack(size_t bytes) {
+    tracked_bytes -= std::min(bytes, tracked_bytes);
+}
+
+void QueryArena::use(size_t bytes) {
+    checkLimit(bytes);
+    used_bytes += bytes;
+    peak_bytes = std::max(peak_bytes, getCurrentBytes());
+}
+
+void QueryArena::unuse(size_t bytes) {
+    used_bytes -= std::min(bytes, used_bytes);
+}
+
+void QueryArena::giveBack(Chunk chunk) {
+    free_chunks.push_back(chunk);
+}
+
+void QueryArena::release() {
+    for(auto &chunk : free_chunks) {
+        std::free(chunk.data);
+        reserved_bytes -= chunk.size;
+    }
+    free_chunks.clear();
+}
+
+ArenaRegion::ArenaRegion(std::shared_ptr<QueryArena> a)
+        : arena(std::move(a)), cursor(nullptr), remaining(0),
+          next_chunk(alignUp(arena->getChunkSize() / firstChunkDivisor)), used_bytes(0) {}
+
+ArenaRegion::~ArenaRegion() {
+    arena->unuse(used_bytes);
+    for(auto &chunk : chunks) arena->giveBack(chunk);
+}
+
+void *ArenaRegion::allocate(size_t bytes) {
+
+    bytes = alignUp(std::max<size_t>(bytes, 1));
+    arena->use(bytes);
+    used_bytes += bytes;
+
+    // large blocks get a chunk of their own so the current bump chunk is not abandoned
+    if(bytes > arena->getChunkSize() / 4) {
+        chunks.push_back(arena->acquire(bytes));
+        return chunks.back().data;
+    }
+
+    if(bytes > remaining) {
+        chunks.push_back(arena->acquire(std::max(next_chunk, bytes)));
+        next_chunk = std::min(2 * next_chunk, arena->getChunkSize());
+        cursor = chunks.back().data;
+        remaining = chunks.back().size;
+    }
+
+    void *p = cursor;
+    cursor += bytes;
+    remaining -= bytes;
+    return p;
+}
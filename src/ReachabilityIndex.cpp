@@ -0,0 +1,228 @@
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include "ReachabilityIndex.h"
+#include "Bitmap.h"
+
+ReachabilityIndex::ReachabilityIndex(std::shared_ptr<SimpleGraph> g, size_t maxBytesPerLabel, size_t maxTotalBytes)
+        : graph(std::move(g)), max_bytes(maxBytesPerLabel), max_total_bytes(maxTotalBytes), no_bytes(0),
+          build_time(0), visit_stamp(0) {}
+
+void ReachabilityIndex::clear() {
+    labels.clear();
+    no_bytes = 0;
+}
+
+void ReachabilityIndex::buildLabel(uint32_t label, LabelIndex &index) {
+
+    uint32_t noVertices = graph->getNoVertices();
+
+    // the edges of the label as offsets into one target array
+    std::vector<uint32_t> offsets(noVertices + 1, 0);
+    for(uint32_t v = 0; v < noVertices; v++) offsets[v + 1] = (uint32_t) SimpleGraph::labelRange(graph->adj[v], label).size();
+    for(uint32_t v = 0; v < noVertices; v++) offsets[v + 1] += offsets[v];
+
+    // worst case: every vertex its own component, every edge in the dag
+    size_t bound = ((size_t) noVertices * (2 * noTraversals + 2) + offsets[noVertices]) * sizeof(uint32_t);
+    index.indexed = bound <= max_bytes && no_bytes + bound <= max_total_bytes;
+    if(!index.indexed) return;
+
+    std::vector<uint32_t> targets(offsets[noVertices]);
+    for(uint32_t v = 0; v < noVertices; v++) {
+        auto range = SimpleGraph::labelRange(graph->adj[v], label);
+        for(uint32_t e = offsets[v]; range.first != range.last; ++range.first) targets[e++] = range.first->second;
+    }
+
+    // tarjan, without recursion. a component is numbered once everything it reaches is, so
+    // the numbers are a reverse topological order of the dag
+    const uint32_t unvisited = UINT32_MAX;
+    std::vector<uint32_t> order(noVertices, unvisited), lowlink(noVertices);
+    std::vector<bool> onStack(noVertices, false);
+    std::vector<uint32_t> open;
+    std::vector<std::pair<uint32_t, uint32_t>> calls; // (vertex, next edge)
+    index.component.assign(noVertices, unvisited);
+    uint32_t counter = 0, noComponents = 0;
+
+    for(uint32_t root = 0; root < noVertices; root++) {
+        if(order[root] != unvisited) continue;
+
+        order[root] = lowlink[root] = counter++;
+        open.push_back(root);
+        onStack[root] = true;
+        calls.emplace_back(root, offsets[root]);
+
+        while(!calls.empty()) {
+            uint32_t v = calls.back().first;
+            if(calls.back().second < offsets[v + 1]) {
+                uint32_t w = targets[calls.back().second++];
+                if(order[w] == unvisited) {
+                    order[w] = lowlink[w] = counter++;
+                    open.push_back(w);
+                    onStack[w] = true;
+                    calls.emplace_back(w, offsets[w]);
+                } else if(onStack[w]) {
+                    lowlink[v] = std::min(lowlink[v], order[w]);
+                }
+                continue;
+            }
+
+            if(lowlink[v] == order[v]) {
+                uint32_t w;
+                do {
+                    w = open.back();
+                    open.pop_back();
+                    onStack[w] = false;
+                    index.component[w] = noComponents;
+                } while(w != v);
+                noComponents++;
+            }
+            calls.pop_back();
+            if(!calls.empty()) lowlink[calls.back().first] = std::min(lowlink[calls.back().first], lowlink[v]);
+        }
+    }
+
+    // the condensation: distinct edges between different components
+    std::vector<uint64_t> dagEdges;
+    for(uint32_t v = 0; v < noVertices; v++) {
+        for(uint32_t e = offsets[v]; e < offsets[v + 1]; e++) {
+            uint32_t from = index.component[v], to = index.component[targets[e]];
+            if(from != to) dagEdges.push_back((uint64_t) from << 32 | to);
+        }
+    }
+    std::sort(dagEdges.begin(), dagEdges.end());
+    dagEdges.erase(std::unique(dagEdges.begin(), dagEdges.end()), dagEdges.end());
+
+    index.dagOffsets.assign(noComponents + 1, 0);
+    index.dagTargets.resize(dagEdges.size());
+    for(size_t e = 0; e < dagEdges.size(); e++) {
+        index.dagOffsets[(dagEdges[e] >> 32) + 1]++;
+        index.dagTargets[e] = (uint32_t) dagEdges[e];
+    }
+    for(uint32_t c = 0; c < noComponents; c++) index.dagOffsets[c + 1] += index.dagOffsets[c];
+
+    // interval labels: post-order rank and the lowest rank below, one traversal with the roots
+    // and children in their natural order, the others in a shuffled one
+    index.intervals.assign((size_t) noComponents * noTraversals * 2, 0);
+    std::vector<uint32_t> roots(noComponents);
+    for(uint32_t c = 0; c < noComponents; c++) roots[c] = noComponents - 1 - c;
+    std::mt19937 rng(label);
+    std::vector<bool> done(noComponents);
+
+    for(uint32_t k = 0; k < noTraversals; k++) {
+        if(k > 0) std::shuffle(roots.begin(), roots.end(), rng);
+        std::fill(done.begin(), done.end(), false);
+        uint32_t rank = 0;
+
+        auto low = [&](uint32_t c) -> uint32_t & { return index.intervals[((size_t) c * noTraversals + k) * 2]; };
+        auto post = [&](uint32_t c) -> uint32_t & { return index.intervals[((size_t) c * noTraversals + k) * 2 + 1]; };
+
+        for(auto root : roots) {
+            if(done[root]) continue;
+            done[root] = true;
+            low(root) = UINT32_MAX;
+            calls.emplace_back(root, 0);
+
+            while(!calls.empty()) {
+                uint32_t c = calls.back().first;
+                uint32_t degree = index.dagOffsets[c + 1] - index.dagOffsets[c];
+                if(calls.back().second < degree) {
+                    uint32_t p = calls.back().second++;
+                    uint32_t d = index.dagTargets[k % 2 == 0 ? index.dagOffsets[c] + p : index.dagOffsets[c + 1] - 1 - p];
+                    if(done[d]) {
+                        low(c) = std::min(low(c), low(d));
+                    } else {
+                        done[d] = true;
+                        low(d) = UINT32_MAX;
+                        calls.emplace_back(d, 0);
+                    }
+                    continue;
+                }
+
+                post(c) = rank++;
+                low(c) = std::min(low(c), post(c));
+                calls.pop_back();
+                if(!calls.empty()) low(calls.back().first) = std::min(low(calls.back().first), low(c));
+            }
+        }
+    }
+}
+
+bool ReachabilityIndex::contains(const LabelIndex &index, uint32_t outer, uint32_t inner) const {
+    const uint32_t *o = &index.intervals[(size_t) outer * noTraversals * 2];
+    const uint32_t *i = &index.intervals[(size_t) inner * noTraversals * 2];
+    for(uint32_t k = 0; k < noTraversals; k++) {
+        if(i[2 * k] < o[2 * k] || i[2 * k + 1] > o[2 * k + 1]) return false;
+    }
+    return true;
+}
+
+bool ReachabilityIndex::reachable(uint32_t source, uint32_t target, uint32_t label) {
+
+    if(source == target) return true;
+
+    if(labels.size() < graph->getNoLabels()) labels.resize(graph->getNoLabels());
+    if(!labels[label].built) {
+        auto start = std::chrono::steady_clock::now();
+        auto &index = labels[label];
+        buildLabel(label, index);
+        index.built = true;
+        if(index.indexed) {
+            no_bytes += (index.component.size() + index.dagOffsets.size() + index.dagTargets.size()
+                         + index.intervals.size()) * sizeof(uint32_t);
+            visited.resize(std::max(visited.size(), index.dagOffsets.size() - 1), 0);
+        }
+        auto end = std::chrono::steady_clock::now();
+        build_time += std::chrono::duration<double, std::milli>(end - start).count();
+    }
+    if(!isIndexed(label)) return traverse(source, target, label);
+
+    auto &index = labels[label];
+    uint32_t from = index.component[source], to = index.component[target];
+    if(from == to) return true;
+
+    // a component only reaches lower numbers, and only the components whose intervals it holds
+    if(to > from || !contains(index, from, to)) return false;
+
+    if(++visit_stamp == 0) {
+        std::fill(visited.begin(), visited.end(), 0);
+        visit_stamp = 1;
+    }
+
+    stack.clear();
+    stack.push_back(from);
+    visited[from] = visit_stamp;
+    while(!stack.empty()) {
+        uint32_t c = stack.back();
+        stack.pop_back();
+        for(uint32_t e = index.dagOffsets[c]; e < index.dagOffsets[c + 1]; e++) {
+            uint32_t d = index.dagTargets[e];
+            if(d == to) return true;
+            if(visited[d] == visit_stamp || d < to || !contains(index, d, to)) continue;
+            visited[d] = visit_stamp;
+            stack.push_back(d);
+        }
+    }
+
+    return false;
+}
+
+bool ReachabilityIndex::traverse(uint32_t source, uint32_t target, uint32_t label) const {
+
+    std::vector<uint64_t> seen(bitmap::noWords(graph->getNoVertices()), 0);
+    std::vector<uint32_t> frontier {source};
+    bitmap::set(seen.data(), source);
+
+    while(!frontier.empty()) {
+        uint32_t v = frontier.back();
+        frontier.pop_back();
+        auto range = SimpleGraph::labelRange(graph->adj[v], label);
+        for(auto edge = range.first; edge != range.last; ++edge) {
+            if(bitmap::test(seen.data(), edge->second)) continue;
+            if(edge->second == target) return true;
+            bitmap::set(seen.data(), edge->second);
+            frontier.push_back(edge->second);
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,78 @@
+#include <algorithm>
+#include "ResultCursor.h"
+#include "Bitmap.h"
+#include "SortedSet.h"
+
+ResultCursor::ResultCursor(std::shared_ptr<SimpleGraph> g, std::shared_lock<std::shared_timed_mutex> lock,
+                           std::vector<std::pair<uint32_t, bool>> labels, std::vector<std::vector<uint64_t>> filters,
+                           uint64_t l)
+        : graph(std::move(g)), snapshot(std::move(lock)), chain(std::move(labels)), level_filters(std::move(filters)),
+          limit(l), no_returned(0), next_source(0), row_source(0), row_position(0) {}
+
+bool ResultCursor::expandNextSource() {
+
+    uint32_t noVertices = graph->getNoVertices();
+    auto levelAllows = [&](uint32_t level, uint32_t vertex) {
+        return level_filters.empty() || bitmap::test(level_filters[level].data(), vertex);
+    };
+
+    while(next_source < noVertices) {
+        uint32_t source = next_source++;
+        if(!levelAllows(0, source)) continue;
+
+        // level by level, the distinct vertices this source reaches after the first i labels
+        frontier.assign(1, source);
+        for(uint32_t i = 0; i < chain.size() && !frontier.empty(); i++) {
+            auto &adjacency = chain[i].second ? graph->reverse_adj : graph->adj;
+            expanded.clear();
+            for(auto vertex : frontier) {
+                auto range = SimpleGraph::labelRange(adjacency[vertex], chain[i].first);
+                for(auto edge = range.first; edge != range.last; ++edge) {
+                    if(levelAllows(i + 1, edge->second)) expanded.push_back(edge->second);
+                }
+            }
+            std::sort(expanded.begin(), expanded.end());
+            expanded.resize(sortedset::dedup(expanded.data(), expanded.size()));
+            frontier.swap(expanded);
+        }
+
+        if(frontier.empty()) continue;
+        row_source = source;
+        row.swap(frontier);
+        row_position = 0;
+        return true;
+    }
+
+    return false;
+}
+
+size_t ResultCursor::nextBatch(std::vector<std::pair<uint32_t, uint32_t>> &batch, size_t batchSize) {
+
+    batch.clear();
+
+    while(isOpen() && batch.size() < batchSize) {
+        if(limit > 0 && no_returned == limit) {
+            close();
+            break;
+        }
+        if(row_position == row.size() && !expandNextSource()) {
+            close();
+            break;
+        }
+
+        size_t n = std::min(row.size() - row_position, batchSize - batch.size());
+        if(limit > 0) n = (size_t) std::min<uint64_t>(n, limit - no_returned);
+        for(size_t i = 0; i < n; i++) batch.emplace_back(row_source, row[row_position + i]);
+        row_position += n;
+        no_returned += n;
+    }
+
+    return batch.size();
+}
+
+void ResultCursor::close() {
+    if(snapshot.owns_lock()) snapshot.unlock();
+    std::vector<uint32_t>().swap(row);
+    std::vector<std::vector<uint64_t>>().swap(level_filters);
+    row_position = 0;
+}
@@ -24,16 +24,28 @@ SimpleEstimator::SimpleEstimator(std::shared_ptr<SimpleGraph> &g){
     distinct_tuples_out = new uint32_t[noLabels] {};
     total_tuples_in = new uint32_t[noLabels] {};
     distinct_tuples_in = new uint32_t[noLabels] {};
+    distinct_sources = 0;
+    distinct_targets = 0;
+    correction = 1.0;
 
+    // keep the statistics in step with merged graph updates instead of re-running prepare
+    listener_id = graph->addDeltaListener([this](const GraphDelta &delta) { applyDelta(delta); });
 }
 
 void SimpleEstimator::prepare() {
-    // do your prep here
+    // do your prep here, on one consistent version of the graph
+    auto snapshot = graph->readLock();
+
     uint32_t* previous_tuples_out = new uint32_t[noLabels] {};
     uint32_t* previous_tuples_in = new uint32_t[noLabels] {};
 
     uint32_t noVertices = graph->getNoVertices();
 
+    std::fill(total_tuples_out, total_tuples_out + noLabels, 0);
+    std::fill(distinct_tuples_out, distinct_tuples_out + noLabels, 0);
+    std::fill(total_tuples_in, total_tuples_in + noLabels, 0);
+    std::fill(distinct_tuples_in, distinct_tuples_in + noLabels, 0);
+
     int tracker = 0;
     uint32_t distinct_out = 0;
     uint32_t distinct_in = 0;
@@ -72,12 +84,29 @@ void SimpleEstimator::prepare() {
         }
     }
 
+    distinct_sources = distinct_out;
+    distinct_targets = distinct_in;
     correction = (double)distinct_out/distinct_in;
 
     delete[] previous_tuples_out;
     delete[] previous_tuples_in;
 }
 
+void SimpleEstimator::applyDelta(const GraphDelta &delta) {
+
+    // per label totals and distinct counts move by exactly what the merge changed
+    for(uint32_t label = 0; label < noLabels; label++) {
+        total_tuples_out[label] += delta.edges[label];
+        total_tuples_in[label] += delta.edges[label];
+        distinct_tuples_out[label] += delta.sources[label];
+        distinct_tuples_in[label] += delta.targets[label];
+    }
+
+    distinct_sources += delta.anySources;
+    distinct_targets += delta.anyTargets;
+    correction = distinct_targets > 0 ? (double)distinct_sources/distinct_targets : 1.0;
+}
+
 cardStat SimpleEstimator::estimate(RPQTree *q) {
 
     // perform your estimation here
@@ -117,6 +146,7 @@ cardStat SimpleEstimator::estimate(RPQTree *q) {
 }
 
 SimpleEstimator::~SimpleEstimator() {
+    graph->removeDeltaListener(listener_id);
     delete[] total_tuples_out;
     delete[] total_tuples_in;
     delete[] distinct_tuples_in;
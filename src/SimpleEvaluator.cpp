@@ -4,26 +4,137 @@
 
 #include "SimpleEstimator.h"
 #include "SimpleEvaluator.h"
+#include "SortedSet.h"
+#include "OperatorKernels.h"
 
 std::regex dirLabel (R"((\d+)\+)");
 std::regex invLabel (R"((\d+)\-)");
 
-struct parseQuery {
-    std::string s;
-    std::string path;
-    std::string t;
+namespace {
+
+    // buffers reused from one output row of a join to the next
+    struct JoinScratch {
+        std::vector<uint32_t> row;
+        std::vector<uint32_t> targets;
+        std::vector<std::pair<const uint32_t *, size_t>> rightRows;
+        std::vector<uint64_t> bits; // allocated on the first dense output row
+    };
+
+    // the pairs an in-memory join collects, accounted to the arena as the vector grows, so a
+    // limit stops the join at the allocation that breaks it rather than after all of them
+    class TrackedPairs {
+
+        QueryArena &arena;
+        std::vector<uint64_t> pairs;
+
+        void grow() {
+            size_t old = pairs.capacity(), next = std::max<size_t>(2 * old, 1024);
+            // the old and the new buffer both exist while the pairs are copied over
+            arena.track(next * sizeof(uint64_t));
+            pairs.reserve(next);
+            arena.untrack(old * sizeof(uint64_t));
+        }
+
+    public:
+
+        explicit TrackedPairs(QueryArena &arena) : arena(arena) {}
+        ~TrackedPairs() { arena.untrack(pairs.capacity() * sizeof(uint64_t)); }
+
+        TrackedPairs(const TrackedPairs &) = delete;
+        TrackedPairs &operator=(const TrackedPairs &) = delete;
+
+        void add(uint64_t pair) {
+            if(pairs.size() == pairs.capacity()) grow();
+            pairs.push_back(pair);
+        }
+
+        std::vector<uint64_t> &get() { return pairs; }
+    };
+
+    // the rows of an input, from memory or streamed back from its runs
+    template <typename F>
+    void forEachRow(const JoinInput &in, std::vector<uint32_t> &row, F f) {
+        if(in.spilled != nullptr) in.spilled->forEachRow(row, f);
+        else in.relation->forEachRow(row, f);
+    }
+
+    // output row of one left source: the union of the right rows of its middles
+    void joinRow(uint32_t source, const uint32_t *middles, size_t count, const HybridRelation &right,
+                 RowSink &out, JoinScratch &scratch) {
 
-    void print() {
-        std::cout << s << ", " << path << ", " << t << std::endl;
+        // size the output row from the right rows it unions
+        uint64_t candidates = 0;
+        bool anyDense = false;
+        for(size_t i = 0; i < count; i++) {
+            candidates += right.getRowSize(middles[i]);
+            anyDense |= right.isDense(middles[i]);
+        }
+        if(candidates == 0) return;
+
+        if(!anyDense && !out.shouldBeDense(candidates)) {
+            // sparse: merge the sorted right rows
+            scratch.rightRows.clear();
+            for(size_t i = 0; i < count; i++) {
+                uint32_t size = right.getRowSize(middles[i]);
+                if(size > 0) scratch.rightRows.emplace_back(right.getTargets(middles[i]), size);
+            }
+            sortedset::kWayMerge(scratch.rightRows, scratch.targets);
+            out.setRow(source, scratch.targets.data(), (uint32_t) scratch.targets.size());
+        } else {
+            // hub: or the right rows together in a bitmap
+            scratch.bits.assign(out.getNoWords(), 0);
+            for(size_t i = 0; i < count; i++) right.unionInto(middles[i], scratch.bits.data());
+            auto card = (uint32_t) bitmap::popcount(scratch.bits.data(), scratch.bits.size());
+            out.setRow(source, scratch.bits.data(), card);
+        }
     }
-};
+}
 
 SimpleEvaluator::SimpleEvaluator(std::shared_ptr<SimpleGraph> &g) {
 
     // works only with SimpleGraph
     graph = g;
     est = nullptr; // estimator not attached by default
-    total_tuples = new uint32_t[graph->getNoLabels()];
+    arena = std::make_shared<QueryArena>();
+    replan_threshold = 10.0;
+    no_arena_allocations = 0;
+    memory_budget = 0;
+    spill_directory = "/tmp";
+    memory_limit = 0;
+    graph_memory = 0;
+    peak_memory = 0;
+    current_memory = 0;
+    spilled_for_limit = false;
+    factorize_threshold = 8.0;
+    no_factorized_joins = 0;
+    no_view_hits = 0;
+    reachability_limit = 64 * 1024 * 1024;
+    reachability_total_limit = 256 * 1024 * 1024;
+    total_tuples = new uint32_t[graph->getNoLabels()] {};
+    noEdges = 0;
+    probeDegreeOut = 0;
+    probeDegreeIn = 0;
+
+    // label totals follow merged graph updates, the probe degrees are refreshed by prepare
+    listener_id = graph->addDeltaListener([this](const GraphDelta &delta) {
+        for(uint32_t label = 0; label < graph->getNoLabels(); label++) {
+            total_tuples[label] += delta.edges[label];
+            noEdges += delta.edges[label];
+        }
+        graph_memory = graph->getMemoryUsage();
+
+        // the views no longer match the graph, prepare() builds them again
+        if(views != nullptr) {
+            views->clear();
+            if(!view_file.empty()) std::remove(view_file.c_str());
+        }
+        if(reachability != nullptr) reachability->clear();
+    });
+}
+
+SimpleEvaluator::~SimpleEvaluator() {
+    graph->removeDeltaListener(listener_id);
+    delete[] total_tuples;
 }
 
 void SimpleEvaluator::attachEstimator(std::shared_ptr<SimpleEstimator> &e) {
@@ -35,123 +146,573 @@ void SimpleEvaluator::prepare() {
     // if attached, prepare the estimator
     if(est != nullptr) est->prepare();
 
-    // prepare other things here.., if necessary
+    // prepare other things here.., if necessary. merges wait until the scans below are done
+    auto snapshot = graph->readLock();
     uint32_t noVertices = graph->getNoVertices();
+    std::fill(total_tuples, total_tuples + graph->getNoLabels(), 0);
+    noEdges = 0;
+    double squaredOut = 0, squaredIn = 0;
 
     for(int i = 0; i < noVertices; i++) {
         for(auto labelTarget : graph->adj[i]) {
             total_tuples[labelTarget.first]++;
         }
+        noEdges += graph->adj[i].size();
+        squaredOut += (double) graph->adj[i].size() * graph->adj[i].size();
+        squaredIn += (double) graph->reverse_adj[i].size() * graph->reverse_adj[i].size();
     }
 
+    // following an edge lands on a vertex with probability proportional to its degree, so the
+    // adjacency list a probe scans is sum(d^2) / sum(d) long, not the plain average
+    probeDegreeOut = noEdges > 0 ? squaredOut / noEdges : 0;
+    probeDegreeIn = noEdges > 0 ? squaredIn / noEdges : 0;
+    graph_memory = graph->getMemoryUsage();
+
+    if(views != nullptr) prepareViews();
+
+    // the labels are indexed on their first closure check, not here
+    reachability.reset();
+
 }
 
-cardStat SimpleEvaluator::computeStats(std::shared_ptr<SimpleGraph> &g) {
+cardStat SimpleEvaluator::computeStats(std::shared_ptr<HybridRelation> &r) {
 
     cardStat stats {};
 
-    for(int source = 0; source < g->getNoVertices(); source++) {
-        if(!g->adj[source].empty()) stats.noOut++;
+    // rows are distinct already, the targets are counted by or-ing all rows into one bitmap
+    std::vector<uint64_t> targets(r->getNoWords(), 0);
+    r->getArena()->track(targets.size() * sizeof(uint64_t));
+
+    for(uint32_t source = 0; source < r->getNoVertices(); source++) {
+        if(r->getRowSize(source) == 0) continue;
+
+        stats.noOut++;
+        stats.noPaths += r->getRowSize(source);
+        r->unionInto(source, targets.data());
     }
 
-    stats.noPaths = g->getNoDistinctEdges();
+    stats.noIn = (uint32_t) bitmap::popcount(targets.data(), targets.size());
+    r->getArena()->untrack(targets.size() * sizeof(uint64_t));
+
+    return stats;
+}
 
-    for(int target = 0; target < g->getNoVertices(); target++) {
-        if(!g->reverse_adj[target].empty()) stats.noIn++;
+cardStat SimpleEvaluator::computeStats(std::shared_ptr<SpilledRelation> &r) {
+
+    cardStat stats {};
+    std::vector<uint64_t> targets(bitmap::noWords(r->getNoVertices()), 0);
+    r->getArena()->track(targets.size() * sizeof(uint64_t));
+
+    // the merged runs come out sorted on the source, so a new row starts where it changes
+    PairCursor cursor(*r);
+    uint64_t key;
+    uint64_t lastSource = UINT64_MAX;
+    while(cursor.next(key)) {
+        if(key >> 32 != lastSource) {
+            stats.noOut++;
+            lastSource = key >> 32;
+        }
+        stats.noPaths++;
+        bitmap::set(targets.data(), (uint32_t) key);
     }
 
+    stats.noIn = (uint32_t) bitmap::popcount(targets.data(), targets.size());
+    r->getArena()->untrack(targets.size() * sizeof(uint64_t));
+
     return stats;
 }
 
-std::shared_ptr<SimpleGraph> SimpleEvaluator::project(uint32_t projectLabel, bool inverse, std::shared_ptr<SimpleGraph> &in) {
+cardStat SimpleEvaluator::computeStats(JoinInput &in) {
+    if(in.factorized != nullptr) return in.factorized->count();
+    return in.spilled != nullptr ? computeStats(in.spilled) : computeStats(in.relation);
+}
+
+std::shared_ptr<HybridRelation> SimpleEvaluator::project(uint32_t projectLabel, bool inverse, std::shared_ptr<SimpleGraph> &in,
+                                                         std::shared_ptr<QueryArena> &arena,
+                                                         const uint64_t *sourceFilter, const uint64_t *targetFilter) {
+
+    auto out = std::make_shared<HybridRelation>(in->getNoVertices(), arena);
+    kernels::projectKernel(inverse, sourceFilter != nullptr, targetFilter != nullptr)(*in, projectLabel, sourceFilter, targetFilter, *out);
+    return out;
+}
 
-    auto out = std::make_shared<SimpleGraph>(in->getNoVertices());
-    out->setNoLabels(in->getNoLabels());
+std::shared_ptr<HybridRelation> SimpleEvaluator::join(std::shared_ptr<HybridRelation> &left, std::shared_ptr<HybridRelation> &right) {
 
-    if(!inverse) {
-        // going forward
-        for(uint32_t source = 0; source < in->getNoVertices(); source++) {
-            for (auto labelTarget : in->adj[source]) {
+    RowSink out(left->getNoVertices(), left->getArena());
+    JoinScratch scratch;
+    // a dense output row is built in scratch before it is copied out
+    size_t scratchBytes = out.getNoWords() * sizeof(uint64_t);
+    left->getArena()->track(scratchBytes);
 
-                auto label = labelTarget.first;
-                auto target = labelTarget.second;
+    JoinInput in {left, 0, false, cardStat {}, nullptr, nullptr, nullptr, nullptr};
+    forEachRow(in, scratch.row, [&](uint32_t source, const uint32_t *middles, size_t count) {
+        joinRow(source, middles, count, *right, out, scratch);
+    });
 
-                if (label == projectLabel)
-                    out->addEdge(source, target, label);
-            }
+    out.finish();
+    left->getArena()->untrack(scratchBytes);
+    return out.getRelation();
+}
+
+JoinInput SimpleEvaluator::makeInput(RPQTree *q) {
+
+    JoinInput in {nullptr, 0, false, cardStat {}, nullptr, nullptr, nullptr, nullptr};
+
+    if(q->isLeaf()) {
+        // leaves stay unmaterialized until a join decides how to read them
+        std::smatch matches;
+
+        if(std::regex_search(q->data, matches, dirLabel)) {
+            in.label = (uint32_t) std::stoul(matches[1]);
+            in.inverse = false;
+        } else if(std::regex_search(q->data, matches, invLabel)) {
+            in.label = (uint32_t) std::stoul(matches[1]);
+            in.inverse = true;
+        } else {
+            throw std::runtime_error(std::string("Label parsing failed: ") + q->data);
         }
+
+        if(est != nullptr) in.stats = est->estimate(q);
+        else in.stats = cardStat {total_tuples[in.label], total_tuples[in.label], total_tuples[in.label]};
+        return in;
+    }
+
+    in.relation = evaluate_aux(q);
+    if(est != nullptr) in.stats = est->estimate(q);
+    else in.stats = computeStats(in.relation);
+    return in;
+}
+
+std::shared_ptr<HybridRelation> SimpleEvaluator::materialize(JoinInput &in) {
+
+    if(in.isLeaf()) in.relation = project(in.label, in.inverse, graph, arena, in.sourceFilter, in.targetFilter);
+
+    if(in.spilled != nullptr) {
+        // read a spilled relation back in, for the joins that need random access to its rows
+        auto relation = std::make_shared<HybridRelation>(in.spilled->getNoVertices(), arena);
+        std::vector<uint32_t> row;
+        forEachRow(in, row, [&](uint32_t source, const uint32_t *targets, size_t count) {
+            relation->setRow(source, targets, (uint32_t) count);
+        });
+        in.relation = relation;
+        in.spilled = nullptr;
+    }
+
+    if(in.factorized != nullptr) {
+        // flattening is the join of the transposed sources with the targets
+        auto bySource = in.factorized->getSources()->transpose();
+        auto targets = in.factorized->getTargets();
+        in.relation = join(bySource, targets);
+        in.factorized = nullptr;
+    }
+
+    return in.relation;
+}
+
+JoinAlgorithm SimpleEvaluator::chooseJoin(const JoinInput &left, const JoinInput &right) const {
+
+    // rough cost model in touched tuples: random row accesses cost more than sequential scans,
+    // a leaf that has to be projected costs a scan over all edges of the graph, and the
+    // algorithms that emit unordered (source, target) pairs pay for sorting them afterwards
+    const double randomAccess = 4.0;
+
+    double l = std::max(1u, left.stats.noPaths);
+    double r = std::max(1u, right.stats.noPaths);
+    double joinKeys = std::max(1u, std::max(left.stats.noIn, right.stats.noOut));
+    double triples = l * r / joinKeys; // (source, middle, target) combinations
+
+    double materializeLeft = left.isLeaf() ? noEdges : 0;
+    double materializeRight = right.isLeaf() ? noEdges : 0;
+    auto sortCost = [](double n) { return n * std::log2(n + 2); };
+
+    // the probes read a leaf straight from the graph only while that beats projecting it
+    double forwardProbes = probesGraph(left, right, false)
+            ? l * probeDegree(right, false) * randomAccess : materializeRight + l * randomAccess;
+    double backwardProbes = probesGraph(right, left, true)
+            ? r * probeDegree(left, true) * randomAccess : materializeLeft + l + r * randomAccess;
+
+    double costs[4];
+    costs[(int) JoinAlgorithm::ForwardProbe] = materializeLeft + forwardProbes + triples;
+    costs[(int) JoinAlgorithm::BackwardProbe] = materializeRight + backwardProbes + sortCost(std::min(l, triples)) + triples;
+    costs[(int) JoinAlgorithm::HashJoin] =
+            materializeLeft + materializeRight + 2 * (l + r) + triples + sortCost(triples);
+    costs[(int) JoinAlgorithm::SortMerge] =
+            materializeLeft + materializeRight + l * randomAccess + r + triples + sortCost(triples);
+
+    // under a memory budget only the forward probe streams its result, the other joins hold
+    // every (source, target) pair of it in memory at once
+    if(memory_budget > 0 && triples * sizeof(uint64_t) > memory_budget) return JoinAlgorithm::ForwardProbe;
+
+    return (JoinAlgorithm) (std::min_element(costs, costs + 4) - costs);
+}
+
+JoinInput SimpleEvaluator::join(JoinInput &left, JoinInput &right, JoinAlgorithm algorithm) {
+
+    if(left.factorized != nullptr || right.factorized != nullptr) return factorizedJoin(left, right);
+    if(shouldFactorize(left, right)) return factorize(left, right);
+
+    // spilled operands can only be read sequentially, which is what the forward probe does
+    if(left.spilled != nullptr || right.spilled != nullptr) algorithm = JoinAlgorithm::ForwardProbe;
+
+    JoinInput out {nullptr, 0, false, cardStat {}, nullptr, nullptr, nullptr, nullptr};
+    switch(algorithm) {
+        case JoinAlgorithm::BackwardProbe: out.relation = backwardProbe(left, right); break;
+        case JoinAlgorithm::HashJoin: out.relation = hashJoin(left, right); break;
+        case JoinAlgorithm::SortMerge: out.relation = sortMergeJoin(left, right); break;
+        default: return forwardProbe(left, right);
+    }
+    return out;
+}
+
+bool SimpleEvaluator::shouldFactorize(JoinInput &left, JoinInput &right) {
+
+    // spilled results stay flat, they are only ever streamed
+    if(factorize_threshold <= 0 || left.spilled != nullptr || right.spilled != nullptr) return false;
+
+    // the estimate has to promise a blow-up before both sides are materialized for the exact check
+    double l = std::max(1u, left.stats.noPaths);
+    double r = std::max(1u, right.stats.noPaths);
+    double joinKeys = std::max(1u, std::max(left.stats.noIn, right.stats.noOut));
+    if(l * r / joinKeys < factorize_threshold * (l + r)) return false;
+
+    auto leftRelation = materialize(left);
+    auto rightRelation = materialize(right);
+
+    // per join vertex, the flat result gets indegree * outdegree pairs and the factorized one
+    // indegree + outdegree entries
+    std::vector<uint32_t> inDegree(graph->getNoVertices(), 0);
+    arena->track(inDegree.size() * sizeof(uint32_t));
+    for(uint32_t source = 0; source < leftRelation->getNoVertices(); source++) {
+        leftRelation->forEachTarget(source, [&](uint32_t middle) { inDegree[middle]++; });
+    }
+
+    double flat = 0, factorized = 0;
+    for(uint32_t middle = 0; middle < graph->getNoVertices(); middle++) {
+        uint32_t outDegree = rightRelation->getRowSize(middle);
+        if(inDegree[middle] == 0 || outDegree == 0) continue;
+        flat += (double) inDegree[middle] * outDegree;
+        factorized += inDegree[middle] + outDegree;
+    }
+    arena->untrack(inDegree.size() * sizeof(uint32_t));
+
+    return flat > factorize_threshold * factorized;
+}
+
+JoinInput SimpleEvaluator::factorize(JoinInput &left, JoinInput &right) {
+
+    // the product of join vertex v is column v of the left side times row v of the right side
+    JoinInput out {nullptr, 0, false, cardStat {}, nullptr, nullptr, nullptr, nullptr};
+    out.factorized = std::make_shared<FactorizedRelation>(materialize(left)->transpose(), materialize(right));
+    no_factorized_joins++;
+    return out;
+}
+
+JoinInput SimpleEvaluator::factorizedJoin(JoinInput &left, JoinInput &right) {
+
+    // a factorized side is sources^T . targets, the join stays factorized by folding the other
+    // side into the targets (when it is on the right) or into the sources (on the left)
+    JoinInput out {nullptr, 0, false, cardStat {}, nullptr, nullptr, nullptr, nullptr};
+
+    if(left.factorized != nullptr && right.factorized != nullptr) {
+        // S^T T . S'^T T' keeps S, the targets become T . S'^T . T'
+        auto targets = left.factorized->getTargets();
+        auto rightSourcesTransposed = right.factorized->getSources()->transpose();
+        auto rightTargets = right.factorized->getTargets();
+        auto middle = join(targets, rightSourcesTransposed);
+        out.factorized = std::make_shared<FactorizedRelation>(left.factorized->getSources(), join(middle, rightTargets));
+    } else if(left.factorized != nullptr) {
+        // S^T T . R = S^T (T . R)
+        auto targets = left.factorized->getTargets();
+        auto rightRelation = materialize(right);
+        out.factorized = std::make_shared<FactorizedRelation>(left.factorized->getSources(), join(targets, rightRelation));
     } else {
-        // going backward
-        for(uint32_t source = 0; source < in->getNoVertices(); source++) {
-            for (auto labelTarget : in->reverse_adj[source]) {
+        // L . S^T T = (S . L^T)^T T
+        auto sources = right.factorized->getSources();
+        auto leftTransposed = materialize(left)->transpose();
+        out.factorized = std::make_shared<FactorizedRelation>(join(sources, leftTransposed), right.factorized->getTargets());
+    }
 
-                auto label = labelTarget.first;
-                auto target = labelTarget.second;
+    return out;
+}
 
-                if (label == projectLabel)
-                    out->addEdge(source, target, label);
-            }
+double SimpleEvaluator::probeDegree(const JoinInput &probed, bool backward) const {
+    // the length of the adjacency list a probe lands on. the probe only reads the range of its
+    // label, so this is an upper bound on the edges it touches, not their expected number
+    bool reverse = probed.inverse != backward;
+    return reverse ? probeDegreeIn : probeDegreeOut;
+}
+
+bool SimpleEvaluator::probesGraph(const JoinInput &driver, const JoinInput &probed, bool backward) const {
+    return probed.isLeaf() && driver.stats.noPaths * probeDegree(probed, backward) < noEdges;
+}
+
+JoinInput SimpleEvaluator::forwardProbe(JoinInput &left, JoinInput &right) {
+
+    if(right.spilled != nullptr) return externalMergeJoin(left, right);
+    if(left.isLeaf()) materialize(left);
+
+    // rows are produced in source order, past the budget they go to disk instead of the arena
+    RowSink out(graph->getNoVertices(), arena, memory_budget, spill_directory);
+    JoinScratch scratch;
+    // a dense output row is built in scratch before it is copied out or spilled
+    size_t scratchBytes = out.getNoWords() * sizeof(uint64_t);
+    arena->track(scratchBytes);
+
+    if(probesGraph(left, right, false)) {
+        // probe the adjacency lists of the graph directly, the right label is never projected
+        bool filtered = right.targetFilter != nullptr;
+        if(left.spilled != nullptr) {
+            kernels::probeKernel<SpilledRelation>(right.inverse, filtered)(*graph, right.label, right.targetFilter, *left.spilled, out);
+        } else {
+            kernels::probeKernel<HybridRelation>(right.inverse, filtered)(*graph, right.label, right.targetFilter, *left.relation, out);
         }
+    } else {
+        auto rightRelation = materialize(right);
+        forEachRow(left, scratch.row, [&](uint32_t source, const uint32_t *middles, size_t count) {
+            joinRow(source, middles, count, *rightRelation, out, scratch);
+        });
     }
 
-    return out;
+    out.finish();
+    arena->untrack(scratchBytes);
+    return JoinInput {out.getRelation(), 0, false, cardStat {}, nullptr, nullptr, out.getSpilled(), nullptr};
 }
 
-std::shared_ptr<SimpleGraph> SimpleEvaluator::join(std::shared_ptr<SimpleGraph> &left, std::shared_ptr<SimpleGraph> &right) {
+JoinInput SimpleEvaluator::externalMergeJoin(JoinInput &left, JoinInput &right) {
+
+    // the spilled right side is only readable in the order of its sources, the join vertices,
+    // so the left pairs are first written out as runs sorted on their target
+    uint32_t noVertices = graph->getNoVertices();
+    if(left.isLeaf()) materialize(left);
+
+    RunWriter byMiddle(spill_directory, memory_budget / 4, arena);
+    std::vector<uint32_t> row;
+    forEachRow(left, row, [&](uint32_t source, const uint32_t *middles, size_t count) {
+        for(size_t i = 0; i < count; i++) byMiddle.add((uint64_t) middles[i] << 32 | source);
+    });
+    auto leftByMiddle = byMiddle.finish(noVertices);
+
+    // both sides are merged on the join vertex into blocks of consecutive join vertices that
+    // fit a quarter of the budget. within a block every source unions the right rows of its
+    // join vertices, so a pair is written once per block instead of once per join vertex
+    PairCursor leftCursor(*leftByMiddle);
+    PairCursor rightCursor(*right.spilled);
+    RunWriter pairs(spill_directory, memory_budget / 4, arena);
+
+    size_t blockKeys = std::max<size_t>(memory_budget / 4 / sizeof(uint64_t), noVertices);
+    size_t blockBytes = blockKeys * sizeof(uint64_t) + bitmap::noWords(noVertices) * sizeof(uint64_t);
+    arena->track(blockBytes);
+
+    std::vector<uint64_t> blockPairs; // (source << 32 | position of the join vertex in the block)
+    std::vector<size_t> rowOffsets {0}; // right rows of the join vertices in the block
+    std::vector<uint32_t> rowTargets;
+    std::vector<std::pair<const uint32_t *, size_t>> rightRows;
+    std::vector<uint32_t> merged;
+    std::vector<uint64_t> bits(bitmap::noWords(noVertices));
+
+    auto joinBlock = [&]() {
+        std::sort(blockPairs.begin(), blockPairs.end());
+        for(size_t i = 0; i < blockPairs.size();) {
+            uint64_t source = blockPairs[i] >> 32;
+            uint64_t candidates = 0;
+            rightRows.clear();
+            for(; i < blockPairs.size() && blockPairs[i] >> 32 == source; i++) {
+                auto position = (uint32_t) blockPairs[i];
+                size_t size = rowOffsets[position + 1] - rowOffsets[position];
+                rightRows.emplace_back(rowTargets.data() + rowOffsets[position], size);
+                candidates += size;
+            }
+
+            if(candidates * 32 > noVertices) {
+                std::fill(bits.begin(), bits.end(), 0);
+                for(auto &rightRow : rightRows) {
+                    for(size_t t = 0; t < rightRow.second; t++) bitmap::set(bits.data(), rightRow.first[t]);
+                }
+                bitmap::forEach(bits.data(), bits.size(), [&](uint32_t target) { pairs.addSorted(source << 32 | target); });
+            } else {
+                sortedset::kWayMerge(rightRows, merged);
+                for(auto target : merged) pairs.addSorted(source << 32 | target);
+            }
+        }
+        // sources in order with distinct, ordered targets: the block's pairs are one run
+        pairs.endRun();
+        blockPairs.clear();
+        rowOffsets.resize(1);
+        rowTargets.clear();
+    };
+
+    std::vector<uint32_t> sources, targets;
+    uint32_t leftMiddle = 0, rightMiddle = 0;
+    bool hasLeft = leftCursor.nextRow(leftMiddle, sources);
+    bool hasRight = rightCursor.nextRow(rightMiddle, targets);
+
+    while(hasLeft && hasRight) {
+        if(leftMiddle < rightMiddle) {
+            hasLeft = leftCursor.nextRow(leftMiddle, sources);
+        } else if(rightMiddle < leftMiddle) {
+            hasRight = rightCursor.nextRow(rightMiddle, targets);
+        } else {
+            // a join vertex is never split, a block holds at least one
+            if(!blockPairs.empty() && blockPairs.size() + sources.size() + (rowTargets.size() + targets.size()) / 2 > blockKeys)
+                joinBlock();
+            auto position = (uint64_t) rowOffsets.size() - 1;
+            for(auto source : sources) blockPairs.push_back((uint64_t) source << 32 | position);
+            rowTargets.insert(rowTargets.end(), targets.begin(), targets.end());
+            rowOffsets.push_back(rowTargets.size());
+
+            hasLeft = leftCursor.nextRow(leftMiddle, sources);
+            hasRight = rightCursor.nextRow(rightMiddle, targets);
+        }
+    }
+    joinBlock();
+    arena->untrack(blockBytes);
 
-    auto out = std::make_shared<SimpleGraph>(left->getNoVertices());
-    out->setNoLabels(1);
+    return JoinInput {nullptr, 0, false, cardStat {}, nullptr, nullptr, pairs.finish(noVertices), nullptr};
+}
 
-    for(uint32_t leftSource = 0; leftSource < left->getNoVertices(); leftSource++) {
-        for (auto labelTarget : left->adj[leftSource]) {
+std::shared_ptr<HybridRelation> SimpleEvaluator::backwardProbe(JoinInput &left, JoinInput &right) {
 
-            int leftTarget = labelTarget.second;
-            // try to join the left target with right source
-            for (auto rightLabelTarget : right->adj[leftTarget]) {
+    auto rightRelation = materialize(right);
 
-                auto rightTarget = rightLabelTarget.second;
-                out->addEdge(leftSource, rightTarget, 0);
+    // walk backwards from the join vertices the right side actually has, collecting only the
+    // left pairs that will find a partner, then probe forward over that reduced left side
+    TrackedPairs pairs(*arena);
 
+    if(probesGraph(right, left, true)) {
+        auto &reverse = left.inverse ? graph->adj : graph->reverse_adj;
+        for(uint32_t middle = 0; middle < rightRelation->getNoVertices(); middle++) {
+            if(rightRelation->getRowSize(middle) == 0) continue;
+            auto range = SimpleGraph::labelRange(reverse[middle], left.label);
+            for(auto edge = range.first; edge != range.last; ++edge) {
+                if(left.sourceFilter == nullptr || bitmap::test(left.sourceFilter, edge->second))
+                    pairs.add((uint64_t) edge->second << 32 | middle);
             }
         }
+    } else {
+        // a leaf is projected in the opposite direction, which is its transpose
+        auto leftTransposed = left.isLeaf()
+                ? project(left.label, !left.inverse, graph, arena, left.targetFilter, left.sourceFilter)
+                : left.relation->transpose();
+        for(uint32_t middle = 0; middle < rightRelation->getNoVertices(); middle++) {
+            if(rightRelation->getRowSize(middle) == 0) continue;
+            leftTransposed->forEachTarget(middle, [&](uint32_t source) {
+                pairs.add((uint64_t) source << 32 | middle);
+            });
+        }
     }
 
-    return out;
+    auto reducedLeft = HybridRelation::fromPairs(graph->getNoVertices(), pairs.get(), arena);
+    return join(reducedLeft, rightRelation);
 }
 
-std::shared_ptr<SimpleGraph> SimpleEvaluator::evaluate_aux(RPQTree *q) {
+std::shared_ptr<HybridRelation> SimpleEvaluator::hashJoin(JoinInput &left, JoinInput &right) {
 
-    // evaluate according to the AST bottom-up
+    auto leftRelation = materialize(left);
+    auto rightRelation = materialize(right);
 
-    if(q->isLeaf()) {
-        // project out the label in the AST
-        std::smatch matches;
+    // partition both sides on the join vertex so every build table stays cache-sized
+    const uint32_t partitionBits = 6;
+    const uint32_t noPartitions = 1u << partitionBits;
+    auto partitionOf = [&](uint32_t middle) { return (middle * 2654435761u) >> (32 - partitionBits); };
 
-        uint32_t label;
-        bool inverse;
+    // the partitions are sized in a first pass and accounted before they are filled
+    std::vector<size_t> leftSizes(noPartitions, 0), rightSizes(noPartitions, 0), rightTargets(noPartitions, 0);
+    size_t partitionBytes = 0;
+    for(uint32_t source = 0; source < leftRelation->getNoVertices(); source++) {
+        leftRelation->forEachTarget(source, [&](uint32_t middle) { leftSizes[partitionOf(middle)]++; });
+        partitionBytes += leftRelation->getRowSize(source) * sizeof(uint64_t);
+    }
+    for(uint32_t middle = 0; middle < rightRelation->getNoVertices(); middle++) {
+        if(rightRelation->getRowSize(middle) == 0) continue;
+        rightSizes[partitionOf(middle)]++;
+        rightTargets[partitionOf(middle)] += rightRelation->getRowSize(middle);
+        partitionBytes += sizeof(uint64_t);
+    }
+    arena->track(partitionBytes);
 
-        if(std::regex_search(q->data, matches, dirLabel)) {
-            label = (uint32_t) std::stoul(matches[1]);
-            inverse = false;
-        } else if(std::regex_search(q->data, matches, invLabel)) {
-            label = (uint32_t) std::stoul(matches[1]);
-            inverse = true;
-        } else {
-            std::cerr << "Label parsing failed!" << std::endl;
-            return nullptr;
+    std::vector<std::vector<uint64_t>> leftParts(noPartitions), rightParts(noPartitions);
+    for(uint32_t p = 0; p < noPartitions; p++) {
+        leftParts[p].reserve(leftSizes[p]);
+        rightParts[p].reserve(rightSizes[p]);
+    }
+    for(uint32_t source = 0; source < leftRelation->getNoVertices(); source++) {
+        leftRelation->forEachTarget(source, [&](uint32_t middle) {
+            leftParts[partitionOf(middle)].push_back((uint64_t) source << 32 | middle);
+        });
+    }
+    for(uint32_t middle = 0; middle < rightRelation->getNoVertices(); middle++) {
+        if(rightRelation->getRowSize(middle) > 0) rightParts[partitionOf(middle)].push_back(middle);
+    }
+
+    TrackedPairs pairs(*arena);
+    std::unordered_map<uint32_t, std::vector<uint32_t>> table;
+
+    for(uint32_t p = 0; p < noPartitions; p++) {
+        if(leftParts[p].empty() || rightParts[p].empty()) continue;
+
+        // the targets of the partition plus a rough node and bucket overhead per entry
+        size_t tableBytes = rightTargets[p] * sizeof(uint32_t) + rightSizes[p] * 64;
+        arena->track(tableBytes);
+        table.clear();
+        for(auto middle : rightParts[p]) {
+            auto &targets = table[(uint32_t) middle];
+            rightRelation->forEachTarget((uint32_t) middle, [&](uint32_t target) { targets.push_back(target); });
         }
 
-        return SimpleEvaluator::project(label, inverse, graph);
+        for(auto sourceMiddle : leftParts[p]) {
+            auto match = table.find((uint32_t) sourceMiddle);
+            if(match == table.end()) continue;
+            uint64_t source = sourceMiddle >> 32;
+            for(auto target : match->second) pairs.add(source << 32 | target);
+        }
+        arena->untrack(tableBytes);
+    }
+
+    auto out = HybridRelation::fromPairs(graph->getNoVertices(), pairs.get(), arena);
+    arena->untrack(partitionBytes);
+    return out;
+}
+
+std::shared_ptr<HybridRelation> SimpleEvaluator::sortMergeJoin(JoinInput &left, JoinInput &right) {
+
+    auto leftRelation = materialize(left);
+    auto rightRelation = materialize(right);
+
+    // both sides ordered by the join vertex: the transposed left rows and the right rows
+    auto leftTransposed = leftRelation->transpose();
+    TrackedPairs pairs(*arena);
+
+    for(uint32_t middle = 0; middle < graph->getNoVertices(); middle++) {
+        if(leftTransposed->getRowSize(middle) == 0 || rightRelation->getRowSize(middle) == 0) continue;
+        leftTransposed->forEachTarget(middle, [&](uint32_t source) {
+            rightRelation->forEachTarget(middle, [&](uint32_t target) {
+                pairs.add((uint64_t) source << 32 | target);
+            });
+        });
+    }
+
+    return HybridRelation::fromPairs(graph->getNoVertices(), pairs.get(), arena);
+}
+
+std::shared_ptr<HybridRelation> SimpleEvaluator::evaluate_aux(RPQTree *q) {
+
+    // evaluate according to the AST bottom-up
+
+    if(q->isLeaf()) {
+        // project out the label in the AST
+        auto in = makeInput(q);
+        return materialize(in);
     }
 
     if(q->isConcat()) {
 
         // evaluate the children
-        auto leftGraph = SimpleEvaluator::evaluate_aux(q->left);
-        auto rightGraph = SimpleEvaluator::evaluate_aux(q->right);
+        auto left = makeInput(q->left);
+        auto right = makeInput(q->right);
 
-        // join left with right
-        return SimpleEvaluator::join(leftGraph, rightGraph);
+        // join left with right, using the cheapest physical join for their sizes
+        auto result = join(left, right, chooseJoin(left, right));
+        return materialize(result);
     }
 
     return nullptr;
@@ -167,12 +728,16 @@ void SimpleEvaluator::planQuery(RPQTree* q) {
 
         if(std::regex_search(q->data, matches, dirLabel)) {
             label = (uint32_t) std::stoul(matches[1]);
-            cardStat cStat = cardStat{est->distinct_tuples_out[label], est->total_tuples_in[label], est->distinct_tuples_in[label]};
+            cardStat cStat = est != nullptr
+                    ? cardStat{est->distinct_tuples_out[label], est->total_tuples_in[label], est->distinct_tuples_in[label]}
+                    : cardStat{total_tuples[label], total_tuples[label], total_tuples[label]};
             query_labels.push_back(std::pair<uint32_t,cardStat>(label, cStat));
             inversed_list.push_back(false);
         } else if(std::regex_search(q->data, matches, invLabel)) {
             label = (uint32_t) std::stoul(matches[1]);
-            cardStat cStat = cardStat{est->distinct_tuples_in[label], est->total_tuples_in[label], est->distinct_tuples_out[label]};
+            cardStat cStat = est != nullptr
+                    ? cardStat{est->distinct_tuples_in[label], est->total_tuples_in[label], est->distinct_tuples_out[label]}
+                    : cardStat{total_tuples[label], total_tuples[label], total_tuples[label]};
             query_labels.push_back(std::pair<uint32_t,cardStat>(label, cStat));
             inversed_list.push_back(true);
         } else {
@@ -187,6 +752,18 @@ void SimpleEvaluator::planQuery(RPQTree* q) {
     }
 }
 
+cardStat SimpleEvaluator::estimateJoin(const cardStat &left, const cardStat &right) const {
+
+    // join estimation from the slides, R join S, in doubles so the product cannot overflow
+    double vry = std::max(1u, left.noOut);
+    double vsy = std::max(1u, right.noIn);
+    double trts = (double) left.noPaths * right.noPaths;
+    double correction = est != nullptr ? est->correction : 1.0;
+
+    auto paths = (uint32_t) std::min(std::min(trts / vsy, trts / vry) * correction, (double) UINT32_MAX);
+    return cardStat {std::min(left.noOut, paths), paths, std::min(right.noIn, paths)};
+}
+
 std::vector<uint32_t> SimpleEvaluator::findBestPlan(std::vector<std::pair<uint32_t, cardStat>> query) {
     cardStat stat {};
     uint32_t nPaths = -1;
@@ -195,13 +772,10 @@ std::vector<uint32_t> SimpleEvaluator::findBestPlan(std::vector<std::pair<uint32
         return std::vector<uint32_t> (0);
     } else {
         for (int i = 1; i < query.size(); i++) {
-            uint32_t vry = query[i - 1].second.noOut;
-            uint32_t vsy = query[i].second.noIn;
-            uint32_t trts = query[i - 1].second.noPaths * query[i].second.noPaths;
-
-            uint32_t paths = (uint32_t) (std::min(trts / vsy, trts / vry) * est->correction);
-            vry = std::min(vry, paths);
-            vsy = std::min(vsy, paths);
+            cardStat joined = estimateJoin(query[i - 1].second, query[i].second);
+            uint32_t vry = joined.noOut;
+            uint32_t vsy = joined.noIn;
+            uint32_t paths = joined.noPaths;
 
             if (nPaths == -1) {
                 stat = cardStat{vry, paths, vsy};
@@ -225,54 +799,384 @@ std::vector<uint32_t> SimpleEvaluator::findBestPlan(std::vector<std::pair<uint32
     }
 }
 
+bool SimpleEvaluator::reduceChain() {
+
+    // Yannakakis-style full reduction of the chain l1/l2/.../ln: level i holds the vertices
+    // that can sit between l_i and l_i+1 on a complete path. a forward sweep keeps what is
+    // reachable from the start, a backward sweep what can still reach the end.
+    auto n = (uint32_t) query_labels.size();
+    uint32_t noVertices = graph->getNoVertices();
+    size_t words = bitmap::noWords(noVertices);
+
+    level_filters.assign(n + 1, std::vector<uint64_t>(words, 0));
+    arena->track((n + 1) * words * sizeof(uint64_t));
+
+    auto adjacencyOf = [&](uint32_t i) -> std::vector<std::vector<std::pair<uint32_t,uint32_t>>> & {
+        return inversed_list[i] ? graph->reverse_adj : graph->adj;
+    };
+
+    // forward: level 0 are the sources of l1, level i the targets of l_i out of level i-1
+    for(uint32_t i = 0; i < n; i++) {
+        auto &adjacency = adjacencyOf(i);
+        uint32_t label = query_labels[i].first;
+        uint64_t *from = level_filters[i].data();
+        uint64_t *to = level_filters[i + 1].data();
+        bool any = false;
+
+        for(uint32_t source = 0; source < noVertices; source++) {
+            if(i > 0 && !bitmap::test(from, source)) continue;
+            auto range = SimpleGraph::labelRange(adjacency[source], label);
+            if(range.empty()) continue;
+            if(i == 0) bitmap::set(from, source);
+            for(auto edge = range.first; edge != range.last; ++edge) bitmap::set(to, edge->second);
+            any = true;
+        }
+        if(!any) return false;
+    }
+
+    // backward: drop the vertices of level i without an l_i+1 edge into level i+1
+    for(uint32_t i = n; i-- > 0;) {
+        auto &adjacency = adjacencyOf(i);
+        uint32_t label = query_labels[i].first;
+        uint64_t *level = level_filters[i].data();
+        const uint64_t *next = level_filters[i + 1].data();
+        bool any = false;
+
+        for(uint32_t vertex = 0; vertex < noVertices; vertex++) {
+            if(!bitmap::test(level, vertex)) continue;
+            auto range = SimpleGraph::labelRange(adjacency[vertex], label);
+            bool keep = std::any_of(range.first, range.last, [&](const std::pair<uint32_t,uint32_t> &edge) {
+                return bitmap::test(next, edge.second);
+            });
+            if(keep) any = true;
+            else level[vertex >> 6] &= ~((uint64_t) 1 << (vertex & 63));
+        }
+        if(!any) return false;
+    }
+
+    return true;
+}
+
+JoinInput SimpleEvaluator::chainInput(uint32_t position) {
+
+    JoinInput in {nullptr, query_labels[position].first, inversed_list[position], query_labels[position].second,
+                  nullptr, nullptr, nullptr, nullptr};
+
+    if(!level_filters.empty()) {
+        in.sourceFilter = level_filters[position].data();
+        in.targetFilter = level_filters[position + 1].data();
+    }
+    return in;
+}
+
+void SimpleEvaluator::setReplanThreshold(double qError) {
+    replan_threshold = qError;
+}
+
+void SimpleEvaluator::setMemoryBudget(size_t bytes, const std::string &spillDirectory) {
+    memory_budget = bytes;
+    spill_directory = spillDirectory;
+}
+
+std::unique_ptr<ResultCursor> SimpleEvaluator::open(RPQTree *query, uint64_t limit) {
+
+    auto snapshot = graph->readLock();
+
+    query_labels.clear();
+    inversed_list.clear();
+    level_filters.clear();
+    planQuery(query);
+
+    // the reduction prunes every dead end up front, so each source the cursor expands yields
+    // pairs, but it is a pass over the edges of every label before the first pair. a small
+    // limit is usually reached after a few sources, so then the cursor starts right away and
+    // skips the dead sources as it expands them
+    const uint64_t smallLimit = 1024;
+    bool empty = false;
+    if(limit == 0 || limit > smallLimit) {
+        empty = !reduceChain();
+        arena->untrack(level_filters.size() * bitmap::noWords(graph->getNoVertices()) * sizeof(uint64_t));
+    }
+
+    std::vector<std::pair<uint32_t, bool>> chain;
+    for(uint32_t i = 0; i < query_labels.size(); i++) chain.emplace_back(query_labels[i].first, inversed_list[i]);
+
+    std::unique_ptr<ResultCursor> cursor(new ResultCursor(graph, std::move(snapshot), std::move(chain),
+                                                          std::move(level_filters), limit));
+    level_filters.clear();
+    if(empty) cursor->close();
+    return cursor;
+}
+
+void SimpleEvaluator::setMemoryLimit(size_t bytes) {
+    memory_limit = bytes;
+}
+
 cardStat SimpleEvaluator::evaluate(RPQTree *query) {
 
+    arena->setLimit(memory_limit);
+    arena->startQuery();
+    spilled_for_limit = false;
+    cardStat stats {};
+
+    try {
+        stats = evaluateChain(query);
+    } catch(MemoryLimitExceeded &) {
+        // the relations of the failed attempt are gone already, only their chunks are left
+        arena->release();
+        arena->startQuery();
+        if(memory_budget > 0) throw;
+
+        // run it once more with intermediate results spilled to disk past half the limit. the
+        // spill buffers and the per-vertex scratch are charged to the arena as well, so a rerun
+        // that still cannot stay under the limit fails the same way. the budget is put back
+        // however the rerun ends
+        struct BudgetGuard {
+            size_t &budget;
+            size_t saved;
+            ~BudgetGuard() { budget = saved; }
+        } guard {memory_budget, memory_budget};
+
+        spilled_for_limit = true;
+        memory_budget = memory_limit / 2;
+        try {
+            stats = evaluateChain(query);
+        } catch(...) {
+            arena->release();
+            throw;
+        }
+    } catch(...) {
+        arena->release();
+        throw;
+    }
+
+    // the reachability index stays in memory between queries, like the graph
+    size_t indexMemory = reachability != nullptr ? reachability->getNoBytes() : 0;
+    peak_memory = graph_memory + indexMemory + arena->getPeakBytes();
+    current_memory = graph_memory + indexMemory + arena->getCurrentBytes();
+
+    return stats;
+}
+
+cardStat SimpleEvaluator::evaluateChain(RPQTree *query) {
+
+    // merges wait until the query is done, so it sees one consistent version of the graph
+    auto snapshot = graph->readLock();
+
     query_labels.clear();
     inversed_list.clear();
+    level_filters.clear();
+    no_arena_allocations = 0;
+    no_factorized_joins = 0;
+    no_view_hits = 0;
+    size_t allocationsBefore = arena->getNoAllocations();
     planQuery(query);
-    std::vector<uint32_t> bestPlan = findBestPlan(query_labels);
 
-    std::vector<std::string> plan;
-    std::string symbol;
-    for(int i = 0; i < query_labels.size(); i++) {
-        if(inversed_list[i] == true) {
-            symbol = "-";
-        } else {
-            symbol = "+";
+    // chains of two or more labels are reduced first, an empty level means an empty result
+    bool empty = query_labels.size() > 1 && !reduceChain();
+    size_t filterBytes = level_filters.size() * bitmap::noWords(graph->getNoVertices()) * sizeof(uint64_t);
+    if(empty) {
+        arena->untrack(filterBytes);
+        return cardStat {0, 0, 0};
+    }
+
+    // runs of labels with a materialized view read the view instead of joining the labels
+    std::vector<JoinInput> operands;
+    LabelPath chain;
+    for(uint32_t i = 0; i < query_labels.size(); i++) chain.emplace_back(query_labels[i].first, inversed_list[i]);
+
+    for(uint32_t i = 0; i < query_labels.size();) {
+        const MaterializedView *view = views != nullptr ? views->match(chain, i) : nullptr;
+        if(view == nullptr) {
+            operands.push_back(chainInput(i++));
+            continue;
+        }
+        operands.push_back(JoinInput {view->relation, 0, false, view->stats, nullptr, nullptr, nullptr, nullptr});
+        i += (uint32_t) view->path.size();
+        no_view_hits++;
+    }
+
+    auto operandStats = [&]() {
+        std::vector<std::pair<uint32_t, cardStat>> stats;
+        for(auto &operand : operands) stats.emplace_back(operand.label, operand.stats);
+        return stats;
+    };
+
+    // run the plan one join at a time. every join result replaces its two operands with its
+    // actual stats, and when those miss the estimate by more than the threshold (q-error),
+    // the rest of the chain is planned again from the actual numbers
+    std::vector<uint32_t> plan = findBestPlan(operandStats());
+
+    while(operands.size() > 1) {
+        uint32_t n = plan.back();
+        plan.pop_back();
+
+        JoinInput &left = operands[n - 1];
+        JoinInput &right = operands[n];
+        cardStat expected = estimateJoin(left.stats, right.stats);
+
+        operands[n - 1] = join(left, right, chooseJoin(left, right));
+        operands[n - 1].stats = computeStats(operands[n - 1]);
+        operands.erase(operands.begin() + n);
+
+        double actualPaths = std::max(1u, operands[n - 1].stats.noPaths);
+        double expectedPaths = std::max(1u, expected.noPaths);
+        double qError = std::max(actualPaths / expectedPaths, expectedPaths / actualPaths);
+
+        if(operands.size() > 2 && qError > replan_threshold) plan = findBestPlan(operandStats());
+    }
+
+    // a single label is counted straight from the graph
+    cardStat stats = operands[0].stats;
+    if(operands[0].isLeaf()) stats = kernels::countKernel(operands[0].inverse)(*graph, operands[0].label);
+
+    // every relation of the query is gone now, hand their memory back in one go
+    no_arena_allocations = arena->getNoAllocations() - allocationsBefore;
+    operands.clear();
+    arena->release();
+    arena->untrack(filterBytes);
+
+    // transposes and joins of a view allocate from the arena of the view
+    if(views != nullptr) views->getArena()->release();
+
+    return stats;
+}
+
+size_t SimpleEvaluator::getNoArenaAllocations() const {
+    return no_arena_allocations;
+}
+
+size_t SimpleEvaluator::getPeakMemory() const {
+    return peak_memory;
+}
+
+size_t SimpleEvaluator::getCurrentMemory() const {
+    return current_memory;
+}
+
+size_t SimpleEvaluator::getGraphMemory() const {
+    return graph_memory;
+}
+
+bool SimpleEvaluator::spilledForLimit() const {
+    return spilled_for_limit;
+}
+
+void SimpleEvaluator::setFactorizeThreshold(double ratio) {
+    factorize_threshold = ratio;
+}
+
+size_t SimpleEvaluator::getNoFactorizedJoins() const {
+    return no_factorized_joins;
+}
+
+void SimpleEvaluator::useViews(std::vector<std::string> workload, size_t budgetBytes, const std::string &viewFile) {
+    views = std::make_shared<ViewCatalog>(budgetBytes);
+    view_workload = std::move(workload);
+    view_file = viewFile;
+}
+
+void SimpleEvaluator::prepareViews() {
+
+    if(!view_file.empty() && views->load(view_file, *graph, view_workload)) return;
+    views->clear();
+
+    // rank the sub-paths by the join work they save per byte: uses times joins saved times the
+    // tuples those joins read, over the estimated size of the view
+    struct Candidate {
+        LabelPath path;
+        double score;
+        double bytes; // estimated size of the view, its per-vertex arrays included
+    };
+    std::vector<Candidate> candidates;
+
+    // a view costs at least its two per-vertex arrays
+    size_t rowArrays = graph->getNoVertices() * (sizeof(uint32_t) + sizeof(void *));
+
+    for(auto &frequent : ViewCatalog::analyze(view_workload)) {
+        auto &path = frequent.first;
+        double inputs = 0;
+        cardStat size {};
+        bool valid = true;
+        for(size_t i = 0; i < path.size() && valid; i++) {
+            uint32_t label = path[i].first;
+            valid = label < graph->getNoLabels();
+            if(!valid) break;
+            cardStat stats {total_tuples[label], total_tuples[label], total_tuples[label]};
+            inputs += total_tuples[label];
+            size = i == 0 ? stats : estimateJoin(size, stats);
         }
-        plan.push_back(std::to_string(query_labels[i].first) + symbol);
+        if(!valid) continue;
+        double bytes = (double) size.noPaths * sizeof(uint32_t) + 1;
+        candidates.push_back(Candidate {path, frequent.second * (path.size() - 1) * inputs / bytes, bytes + rowArrays});
+    }
+    std::stable_sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b) {
+        return a.score > b.score;
+    });
+
+    // the query limit is put back however the views end up
+    struct LimitGuard {
+        QueryArena &arena;
+        size_t saved;
+        ~LimitGuard() { arena.setLimit(saved); }
+    } guard {*arena, arena->getLimit()};
+
+    for(auto &candidate : candidates) {
+        size_t room = views->getBudget() - views->getUsedBytes();
+        if(room < rowArrays) break;
+        // a candidate estimated not to fit is passed over before any of its joins run
+        if(candidate.bytes > room) continue;
+
+        // the same joins as a query, on the unreduced labels. they run with the room left as
+        // the limit, so a candidate that outgrows the estimate is dropped as soon as it does
+        std::string path = ViewCatalog::toString(candidate.path);
+        RPQTree *tree = RPQTree::strToTree(path);
+        arena->setLimit(room);
+        arena->startQuery();
+        try {
+            auto relation = evaluate_aux(tree);
+            views->add(candidate.path, *relation, computeStats(relation));
+        } catch(MemoryLimitExceeded &) {}
+        delete(tree);
+        arena->release();
     }
 
-    while(bestPlan.size() > 0) {
-        uint32_t n = bestPlan.back();
-        bestPlan.pop_back();
-        std::string spot = plan[n];
-        plan[n - 1] = "(" + plan[n - 1] + "/" + spot + ")";
-        plan.erase(plan.begin() + n);
+    if(view_file.empty()) return;
+    try {
+        views->save(view_file, *graph, view_workload);
+    } catch(std::runtime_error &e) {
+        std::cerr << e.what() << std::endl;
     }
+}
 
-    plan[0] = "*, " + plan[0] + ", *";
+std::shared_ptr<ViewCatalog> SimpleEvaluator::getViews() const {
+    return views;
+}
 
-    // make a new query tree
-    std::regex edgePat (R"((.+),(.+),(.+))");
+size_t SimpleEvaluator::getNoViewHits() const {
+    return no_view_hits;
+}
 
-    std::smatch matches;
-    parseQuery p;
-    std::string line = plan[0];
+void SimpleEvaluator::setReachabilityLimit(size_t bytesPerLabel, size_t totalBytes) {
+    reachability_limit = bytesPerLabel;
+    reachability_total_limit = totalBytes;
+}
 
-    // match edge data
-    if(std::regex_search(line, matches, edgePat)) {
-        auto s = matches[1];
-        auto path = matches[2];
-        auto t = matches[3];
+bool SimpleEvaluator::reachable(uint32_t source, uint32_t target, uint32_t label, bool inverse) {
 
-        p = parseQuery{s, path, t};
+    auto snapshot = graph->readLock();
+    if(source >= graph->getNoVertices() || target >= graph->getNoVertices() || label >= graph->getNoLabels()) {
+        return source == target;
     }
 
-    RPQTree *pTree = RPQTree::strToTree(p.path);
-    std::cout << "\nParsed pTree: ";
-    pTree->print();
+    if(reachability == nullptr) reachability.reset(new ReachabilityIndex(graph, reachability_limit, reachability_total_limit));
+    bool reaches = inverse ? reachability->reachable(target, source, label) : reachability->reachable(source, target, label);
 
-    auto res = evaluate_aux(pTree);
-    return SimpleEvaluator::computeStats(res);
-}
\ No newline at end of file
+    current_memory = graph_memory + reachability->getNoBytes();
+    peak_memory = current_memory;
+    return reaches;
+}
+
+const ReachabilityIndex *SimpleEvaluator::getReachabilityIndex() const {
+    return reachability.get();
+}
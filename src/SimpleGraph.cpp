@@ -3,11 +3,16 @@
 //
 
 #include "SimpleGraph.h"
+#include "SortedSet.h"
 
-SimpleGraph::SimpleGraph(uint32_t n)   {
+SimpleGraph::SimpleGraph(uint32_t n) : next_listener(0), merger_running(false) {
     setNoVertices(n);
 }
 
+SimpleGraph::~SimpleGraph() {
+    stopBackgroundMerge();
+}
+
 uint32_t SimpleGraph::getNoVertices() const {
     return V;
 }
@@ -25,32 +30,24 @@ uint32_t SimpleGraph::getNoEdges() const {
     return sum;
 }
 
-// sort on the second item in the pair, then on the first (ascending order)
-bool sortPairs(const std::pair<uint32_t,uint32_t> &a, const std::pair<uint32_t,uint32_t> &b) {
-    if (a.second < b.second) return true;
-    if (a.second == b.second) return a.first < b.first;
-    return false;
-}
-
 uint32_t SimpleGraph::getNoDistinctEdges() const {
 
     uint32_t sum = 0;
 
-    for (auto sourceVec : adj) {
+    // per source, bucket the targets by label and count the distinct ones of each bucket
+    std::vector<std::vector<uint32_t>> targetsPerLabel(L);
 
-        std::sort(sourceVec.begin(), sourceVec.end(), sortPairs);
+    for (const auto &sourceVec : adj) {
 
-        uint32_t prevTarget = 0;
-        uint32_t prevLabel = 0;
-        bool first = true;
+        for (const auto &labelTgtPair : sourceVec)
+            targetsPerLabel[labelTgtPair.first].push_back(labelTgtPair.second);
 
         for (const auto &labelTgtPair : sourceVec) {
-            if (first || !(prevTarget == labelTgtPair.second && prevLabel == labelTgtPair.first)) {
-                first = false;
-                sum++;
-                prevTarget = labelTgtPair.second;
-                prevLabel = labelTgtPair.first;
-            }
+            auto &targets = targetsPerLabel[labelTgtPair.first];
+            if (targets.empty()) continue;
+            std::sort(targets.begin(), targets.end());
+            sum += sortedset::dedup(targets.data(), targets.size());
+            targets.clear();
         }
     }
 
@@ -61,21 +58,69 @@ uint32_t SimpleGraph::getNoLabels() const {
     return L;
 }
 
+size_t SimpleGraph::getMemoryUsage() const {
+
+    size_t bytes = (adj.capacity() + reverse_adj.capacity()) * sizeof(adj[0]);
+    for(uint32_t i = 0; i < adj.size(); i++) bytes += adj[i].capacity() * sizeof(adj[i][0]);
+    for(uint32_t i = 0; i < reverse_adj.size(); i++) bytes += reverse_adj[i].capacity() * sizeof(reverse_adj[i][0]);
+
+    return bytes;
+}
+
 void SimpleGraph::setNoLabels(uint32_t noLabels) {
     L = noLabels;
 }
 
-void SimpleGraph::addEdge(uint32_t from, uint32_t to, uint32_t edgeLabel) {
+void SimpleGraph::checkEdge(uint32_t from, uint32_t to, uint32_t edgeLabel) const {
     if(from >= V || to >= V || edgeLabel >= L)
         throw std::runtime_error(std::string("Edge data out of bounds: ") +
                                  "(" + std::to_string(from) + "," + std::to_string(to) + "," +
                                  std::to_string(edgeLabel) + ")");
+}
+
+void SimpleGraph::addEdge(uint32_t from, uint32_t to, uint32_t edgeLabel) {
+    checkEdge(from, to, edgeLabel);
+    auto out = std::make_pair(edgeLabel, to);
+    auto in = std::make_pair(edgeLabel, from);
+    adj[from].insert(std::upper_bound(adj[from].begin(), adj[from].end(), out), out);
+    reverse_adj[to].insert(std::upper_bound(reverse_adj[to].begin(), reverse_adj[to].end(), in), in);
+}
+
+void SimpleGraph::appendEdge(uint32_t from, uint32_t to, uint32_t edgeLabel) {
+    checkEdge(from, to, edgeLabel);
     adj[from].emplace_back(std::make_pair(edgeLabel, to));
     reverse_adj[to].emplace_back(std::make_pair(edgeLabel, from));
 }
 
+void SimpleGraph::sortRows() {
+    for(auto &row : adj) std::sort(row.begin(), row.end());
+    for(auto &row : reverse_adj) std::sort(row.begin(), row.end());
+}
+
 void SimpleGraph::readFromContiguousFile(const std::string &fileName) {
 
+    // appended in file order, sorted once at the end
+    readContiguousFile(fileName, [this](uint32_t from, uint32_t to, uint32_t label) { appendEdge(from, to, label); });
+    sortRows();
+}
+
+uint32_t SimpleGraph::shardOf(uint32_t vertex, uint32_t noShards) {
+    return (vertex * 2654435761u) % noShards;
+}
+
+void SimpleGraph::readShardFromContiguousFile(const std::string &fileName, uint32_t shard, uint32_t noShards) {
+
+    readContiguousFile(fileName, [&](uint32_t from, uint32_t to, uint32_t label) {
+        checkEdge(from, to, label);
+        if(shardOf(from, noShards) == shard) adj[from].emplace_back(std::make_pair(label, to));
+        if(shardOf(to, noShards) == shard) reverse_adj[to].emplace_back(std::make_pair(label, from));
+    });
+    sortRows();
+}
+
+void SimpleGraph::readContiguousFile(const std::string &fileName,
+                                     const std::function<void(uint32_t, uint32_t, uint32_t)> &edge) {
+
     std::string line;
     std::ifstream graphFile { fileName };
 
@@ -103,10 +148,130 @@ void SimpleGraph::readFromContiguousFile(const std::string &fileName) {
             uint32_t predicate = (uint32_t) std::stoul(matches[2]);
             uint32_t object = (uint32_t) std::stoul(matches[3]);
 
-            addEdge(subject, object, predicate);
+            edge(subject, object, predicate);
         }
     }
 
     graphFile.close();
 
-}
\ No newline at end of file
+}
+
+void SimpleGraph::stageUpdates(const std::vector<EdgeUpdate> &batch) {
+
+    for(auto &update : batch) checkEdge(update.from, update.to, update.label);
+
+    std::lock_guard<std::mutex> lock(delta_mutex);
+    delta.insert(delta.end(), batch.begin(), batch.end());
+}
+
+size_t SimpleGraph::getNoStagedUpdates() {
+    std::lock_guard<std::mutex> lock(delta_mutex);
+    return delta.size();
+}
+
+namespace {
+
+    bool hasLabel(const std::vector<std::pair<uint32_t,uint32_t>> &row, uint32_t label) {
+        return !SimpleGraph::labelRange(row, label).empty();
+    }
+
+    // applies one update to one side (adj or reverse_adj) and records how the number of
+    // vertices with an edge of the label, and with any edge, changed
+    bool applyToRow(std::vector<std::pair<uint32_t,uint32_t>> &row, uint32_t label, uint32_t other, bool insert,
+                    int64_t &labelVertices, int64_t &anyVertices) {
+
+        bool hadLabel = hasLabel(row, label);
+        bool hadAny = !row.empty();
+
+        // the row stays sorted on (label, target)
+        auto edge = std::make_pair(label, other);
+        if(insert) {
+            row.insert(std::upper_bound(row.begin(), row.end(), edge), edge);
+        } else {
+            auto position = std::lower_bound(row.begin(), row.end(), edge);
+            if(position == row.end() || *position != edge) return false;
+            row.erase(position);
+        }
+
+        labelVertices += (int64_t) hasLabel(row, label) - (int64_t) hadLabel;
+        anyVertices += (int64_t) !row.empty() - (int64_t) hadAny;
+        return true;
+    }
+
+}
+
+GraphDelta SimpleGraph::mergeDelta() {
+
+    std::lock_guard<std::mutex> merging(merge_mutex);
+    std::vector<EdgeUpdate> batch;
+    {
+        std::lock_guard<std::mutex> lock(delta_mutex);
+        batch.swap(delta);
+    }
+
+    GraphDelta change;
+    change.edges.assign(L, 0);
+    change.sources.assign(L, 0);
+    change.targets.assign(L, 0);
+    if(batch.empty()) return change;
+
+    std::unique_lock<std::shared_timed_mutex> exclusive(snapshot_mutex);
+
+    for(auto &update : batch) {
+        // deleting an edge that is not there is a no-op
+        if(!applyToRow(adj[update.from], update.label, update.to, update.insert,
+                       change.sources[update.label], change.anySources)) continue;
+        applyToRow(reverse_adj[update.to], update.label, update.from, update.insert,
+                   change.targets[update.label], change.anyTargets);
+        change.edges[update.label] += update.insert ? 1 : -1;
+    }
+
+    std::lock_guard<std::mutex> lock(listener_mutex);
+    for(auto &listener : listeners) listener.second(change);
+
+    return change;
+}
+
+void SimpleGraph::startBackgroundMerge(std::chrono::milliseconds interval) {
+
+    stopBackgroundMerge();
+    merger_running = true;
+
+    merger = std::thread([this, interval]() {
+        std::unique_lock<std::mutex> lock(merger_mutex);
+        while(merger_running) {
+            merger_wakeup.wait_for(lock, interval, [this]() { return !merger_running; });
+            lock.unlock();
+            mergeDelta();
+            lock.lock();
+        }
+    });
+}
+
+void SimpleGraph::stopBackgroundMerge() {
+
+    {
+        std::lock_guard<std::mutex> lock(merger_mutex);
+        merger_running = false;
+    }
+    merger_wakeup.notify_all();
+    if(merger.joinable()) merger.join();
+}
+
+std::shared_lock<std::shared_timed_mutex> SimpleGraph::readLock() const {
+    return std::shared_lock<std::shared_timed_mutex>(snapshot_mutex);
+}
+
+size_t SimpleGraph::addDeltaListener(std::function<void(const GraphDelta &)> listener) {
+    std::lock_guard<std::mutex> lock(listener_mutex);
+    listeners.emplace_back(next_listener, std::move(listener));
+    return next_listener++;
+}
+
+void SimpleGraph::removeDeltaListener(size_t id) {
+    std::lock_guard<std::mutex> lock(listener_mutex);
+    listeners.erase(std::remove_if(listeners.begin(), listeners.end(),
+                                   [id](const std::pair<size_t, std::function<void(const GraphDelta &)>> &l) {
+                                       return l.first == id;
+                                   }), listeners.end());
+}
@@ -0,0 +1,352 @@
+#include <algorithm>
+#include <queue>
+#include <tuple>
+#include "SortedSet.h"
+#include "CpuFeatures.h"
+
+#if QS_X86_DISPATCH
+#include <immintrin.h>
+#endif
+
+// scalar reference kernels
+
+size_t sortedset::scalar::unite(const uint32_t *a, size_t na, const uint32_t *b, size_t nb, uint32_t *out) {
+    size_t i = 0, j = 0, n = 0;
+    while(i < na && j < nb) {
+        if(a[i] < b[j]) out[n++] = a[i++];
+        else if(b[j] < a[i]) out[n++] = b[j++];
+        else { out[n++] = a[i++]; j++; }
+    }
+    while(i < na) out[n++] = a[i++];
+    while(j < nb) out[n++] = b[j++];
+    return n;
+}
+
+size_t sortedset::scalar::intersect(const uint32_t *a, size_t na, const uint32_t *b, size_t nb, uint32_t *out) {
+    size_t i = 0, j = 0, n = 0;
+    while(i < na && j < nb) {
+        if(a[i] < b[j]) i++;
+        else if(b[j] < a[i]) j++;
+        else { out[n++] = a[i++]; j++; }
+    }
+    return n;
+}
+
+size_t sortedset::scalar::dedup(uint32_t *a, size_t n) {
+    if(n < 2) return n;
+    size_t out = 1;
+    for(size_t i = 1; i < n; i++) {
+        if(a[i] != a[out - 1]) a[out++] = a[i];
+    }
+    return out;
+}
+
+void sortedset::scalar::kWayMerge(const std::vector<std::pair<const uint32_t *, size_t>> &lists, std::vector<uint32_t> &out) {
+
+    // (value, list, position) min-heap
+    typedef std::tuple<uint32_t, size_t, size_t> head;
+    std::priority_queue<head, std::vector<head>, std::greater<head>> heads;
+
+    size_t total = 0;
+    for(size_t l = 0; l < lists.size(); l++) {
+        if(lists[l].second > 0) heads.emplace(lists[l].first[0], l, 0);
+        total += lists[l].second;
+    }
+
+    out.clear();
+    out.reserve(total);
+
+    while(!heads.empty()) {
+        auto top = heads.top();
+        heads.pop();
+
+        uint32_t value = std::get<0>(top);
+        size_t l = std::get<1>(top), pos = std::get<2>(top) + 1;
+        if(out.empty() || out.back() != value) out.push_back(value);
+        if(pos < lists[l].second) heads.emplace(lists[l].first[pos], l, pos);
+    }
+}
+
+#if QS_X86_DISPATCH
+
+namespace {
+
+    // pshufb masks that move the lanes selected by a 4-bit mask to the front
+    struct PackTable4 {
+        __m128i masks[16];
+        PackTable4() {
+            for(int m = 0; m < 16; m++) {
+                alignas(16) uint8_t bytes[16];
+                int n = 0;
+                for(int lane = 0; lane < 4; lane++) {
+                    if(!(m & (1 << lane))) continue;
+                    for(int b = 0; b < 4; b++) bytes[n * 4 + b] = (uint8_t) (lane * 4 + b);
+                    n++;
+                }
+                for(int b = n * 4; b < 16; b++) bytes[b] = 0x80;
+                masks[m] = _mm_load_si128((const __m128i *) bytes);
+            }
+        }
+    };
+
+    // vpermd indices that move the lanes selected by an 8-bit mask to the front
+    struct PackTable8 {
+        alignas(32) uint32_t indices[256][8];
+        PackTable8() {
+            for(int m = 0; m < 256; m++) {
+                int n = 0;
+                for(int lane = 0; lane < 8; lane++) {
+                    if(m & (1 << lane)) indices[m][n++] = (uint32_t) lane;
+                }
+                for(; n < 8; n++) indices[m][n] = 0;
+            }
+        }
+    };
+
+    const PackTable4 pack4;
+    const PackTable8 pack8;
+
+    // sorts the 8 values of two ascending vectors: a receives the lower, b the upper half
+    QS_TARGET("sse4.1")
+    inline void bitonicMerge4(__m128i &a, __m128i &b) {
+        b = _mm_shuffle_epi32(b, _MM_SHUFFLE(0, 1, 2, 3));
+        __m128i l1 = _mm_min_epu32(a, b);
+        __m128i h1 = _mm_max_epu32(a, b);
+
+        __m128i p = _mm_unpacklo_epi64(l1, h1);
+        __m128i q = _mm_unpackhi_epi64(l1, h1);
+        __m128i l2 = _mm_min_epu32(p, q);
+        __m128i h2 = _mm_max_epu32(p, q);
+
+        __m128i x = _mm_unpacklo_epi32(l2, h2);
+        __m128i y = _mm_unpackhi_epi32(l2, h2);
+        __m128i t1 = _mm_unpacklo_epi64(x, y);
+        __m128i t2 = _mm_unpackhi_epi64(x, y);
+        __m128i l3 = _mm_min_epu32(t1, t2);
+        __m128i h3 = _mm_max_epu32(t1, t2);
+
+        a = _mm_unpacklo_epi32(l3, h3);
+        b = _mm_unpackhi_epi32(l3, h3);
+    }
+
+    QS_TARGET("sse4.1")
+    size_t dedupSSE(uint32_t *a, size_t n) {
+        if(n < 2) return n;
+
+        size_t i = 1, out = 1;
+        __m128i last = _mm_set1_epi32((int) a[0]);
+
+        // the store never reaches past the block that was just loaded, so this works in place
+        for(; i + 4 <= n; i += 4) {
+            __m128i v = _mm_loadu_si128((const __m128i *) (a + i));
+            __m128i prev = _mm_alignr_epi8(v, last, 12);
+            int keep = ~_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, prev))) & 0xF;
+            _mm_storeu_si128((__m128i *) (a + out), _mm_shuffle_epi8(v, pack4.masks[keep]));
+            out += __builtin_popcount(keep);
+            last = v;
+        }
+
+        uint32_t prev = (uint32_t) _mm_extract_epi32(last, 3);
+        for(; i < n; i++) {
+            if(a[i] != prev) a[out++] = a[i];
+            prev = a[i];
+        }
+        return out;
+    }
+
+    QS_TARGET("avx2")
+    size_t dedupAVX2(uint32_t *a, size_t n) {
+        if(n < 2) return n;
+
+        size_t i = 1, out = 1;
+        uint32_t prev = a[0];
+        const __m256i rotate = _mm256_setr_epi32(7, 0, 1, 2, 3, 4, 5, 6);
+
+        for(; i + 8 <= n; i += 8) {
+            __m256i v = _mm256_loadu_si256((const __m256i *) (a + i));
+            __m256i shifted = _mm256_blend_epi32(_mm256_permutevar8x32_epi32(v, rotate), _mm256_set1_epi32((int) prev), 1);
+            int keep = ~_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(v, shifted))) & 0xFF;
+            __m256i perm = _mm256_load_si256((const __m256i *) pack8.indices[keep]);
+            _mm256_storeu_si256((__m256i *) (a + out), _mm256_permutevar8x32_epi32(v, perm));
+            out += __builtin_popcount(keep);
+            prev = (uint32_t) _mm256_extract_epi32(v, 7);
+        }
+
+        for(; i < n; i++) {
+            if(a[i] != prev) a[out++] = a[i];
+            prev = a[i];
+        }
+        return out;
+    }
+
+    // merges two sorted arrays (duplicates kept), out needs room for na + nb values
+    QS_TARGET("sse4.1")
+    size_t mergeSSE(const uint32_t *a, size_t na, const uint32_t *b, size_t nb, uint32_t *out) {
+        if(na < 4 || nb < 4) return (size_t) (std::merge(a, a + na, b, b + nb, out) - out);
+
+        __m128i va = _mm_loadu_si128((const __m128i *) a);
+        __m128i vb = _mm_loadu_si128((const __m128i *) b);
+        size_t i = 4, j = 4, n = 0;
+
+        while(true) {
+            bitonicMerge4(va, vb);
+            _mm_storeu_si128((__m128i *) (out + n), va);
+            n += 4;
+
+            // refill from the list with the smaller head, stop once either cannot give a full block
+            if(i + 4 > na || j + 4 > nb) break;
+            if(a[i] <= b[j]) { va = _mm_loadu_si128((const __m128i *) (a + i)); i += 4; }
+            else { va = _mm_loadu_si128((const __m128i *) (b + j)); j += 4; }
+        }
+
+        // the carried upper half and the short tail fit in 7 values, merge them with the long tail
+        alignas(16) uint32_t carry[4];
+        _mm_store_si128((__m128i *) carry, vb);
+        uint32_t small[8];
+        const uint32_t *longTail = (i + 4 > na) ? b + j : a + i;
+        const uint32_t *longEnd = (i + 4 > na) ? b + nb : a + na;
+        const uint32_t *shortTail = (i + 4 > na) ? a + i : b + j;
+        const uint32_t *shortEnd = (i + 4 > na) ? a + na : b + nb;
+        uint32_t *smallEnd = std::merge(carry, carry + 4, shortTail, shortEnd, small);
+        return (size_t) (std::merge(small, smallEnd, longTail, longEnd, out + n) - out);
+    }
+
+    QS_TARGET("sse4.1")
+    size_t intersectSSE(const uint32_t *a, size_t na, const uint32_t *b, size_t nb, uint32_t *out) {
+        size_t i = 0, j = 0, n = 0;
+        size_t capacity = std::min(na, nb);
+
+        while(i + 4 <= na && j + 4 <= nb) {
+            __m128i va = _mm_loadu_si128((const __m128i *) (a + i));
+            __m128i vb = _mm_loadu_si128((const __m128i *) (b + j));
+
+            // all-pairs compare of the two blocks through three rotations of vb
+            __m128i eq = _mm_or_si128(
+                    _mm_or_si128(_mm_cmpeq_epi32(va, vb),
+                                 _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1)))),
+                    _mm_or_si128(_mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(1, 0, 3, 2))),
+                                 _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(2, 1, 0, 3)))));
+            int match = _mm_movemask_ps(_mm_castsi128_ps(eq));
+
+            if(match != 0) {
+                __m128i packed = _mm_shuffle_epi8(va, pack4.masks[match]);
+                if(n + 4 <= capacity) {
+                    _mm_storeu_si128((__m128i *) (out + n), packed);
+                    n += __builtin_popcount(match);
+                } else {
+                    alignas(16) uint32_t tmp[4];
+                    _mm_store_si128((__m128i *) tmp, packed);
+                    for(int k = 0; k < __builtin_popcount(match); k++) out[n++] = tmp[k];
+                }
+            }
+
+            uint32_t maxA = a[i + 3], maxB = b[j + 3];
+            if(maxA <= maxB) i += 4;
+            if(maxB <= maxA) j += 4;
+        }
+
+        return n + sortedset::scalar::intersect(a + i, na - i, b + j, nb - j, out + n);
+    }
+
+}
+
+#endif
+
+namespace {
+
+    typedef size_t (*DedupFn)(uint32_t *, size_t);
+    typedef size_t (*SetOpFn)(const uint32_t *, size_t, const uint32_t *, size_t, uint32_t *);
+
+    struct Kernels {
+        DedupFn dedup;
+        SetOpFn merge;     // keeps duplicates, followed by dedup for the union
+        SetOpFn intersect;
+        const char *name;
+    };
+
+    size_t mergeScalar(const uint32_t *a, size_t na, const uint32_t *b, size_t nb, uint32_t *out) {
+        return (size_t) (std::merge(a, a + na, b, b + nb, out) - out);
+    }
+
+    Kernels pickKernels() {
+#if QS_X86_DISPATCH
+        if(cpu::hasAVX2()) return Kernels{dedupAVX2, mergeSSE, intersectSSE, "avx2"};
+        if(cpu::hasSSE41()) return Kernels{dedupSSE, mergeSSE, intersectSSE, "sse4.1"};
+#endif
+        return Kernels{sortedset::scalar::dedup, mergeScalar, sortedset::scalar::intersect, "scalar"};
+    }
+
+    const Kernels &kernels() {
+        static const Kernels k = pickKernels();
+        return k;
+    }
+
+}
+
+size_t sortedset::unite(const uint32_t *a, size_t na, const uint32_t *b, size_t nb, uint32_t *out) {
+    if(na == 0) { std::copy(b, b + nb, out); return nb; }
+    if(nb == 0) { std::copy(a, a + na, out); return na; }
+    size_t n = kernels().merge(a, na, b, nb, out);
+    return kernels().dedup(out, n);
+}
+
+size_t sortedset::intersect(const uint32_t *a, size_t na, const uint32_t *b, size_t nb, uint32_t *out) {
+    return kernels().intersect(a, na, b, nb, out);
+}
+
+size_t sortedset::dedup(uint32_t *a, size_t n) {
+    return kernels().dedup(a, n);
+}
+
+void sortedset::kWayMerge(const std::vector<std::pair<const uint32_t *, size_t>> &lists, std::vector<uint32_t> &out) {
+
+    size_t total = 0;
+    for(auto &list : lists) total += list.second;
+
+    if(lists.size() == 1) {
+        out.assign(lists[0].first, lists[0].first + lists[0].second);
+        return;
+    }
+
+    out.resize(total);
+    if(lists.size() == 2) {
+        out.resize(unite(lists[0].first, lists[0].second, lists[1].first, lists[1].second, out.data()));
+        return;
+    }
+
+    // pairwise merge tree: each round unites neighbouring runs of cur into next
+    static thread_local std::vector<uint32_t> cur, next;
+    static thread_local std::vector<size_t> bounds, nextBounds;
+
+    cur.resize(total);
+    bounds.assign(1, 0);
+    for(auto &list : lists) {
+        std::copy(list.first, list.first + list.second, cur.begin() + bounds.back());
+        bounds.push_back(bounds.back() + list.second);
+    }
+
+    while(bounds.size() > 2) {
+        next.resize(bounds.back());
+        nextBounds.assign(1, 0);
+        for(size_t r = 0; r + 1 < bounds.size(); r += 2) {
+            const uint32_t *a = cur.data() + bounds[r];
+            size_t na = bounds[r + 1] - bounds[r];
+            size_t n;
+            if(r + 2 < bounds.size()) {
+                n = unite(a, na, cur.data() + bounds[r + 1], bounds[r + 2] - bounds[r + 1], next.data() + nextBounds.back());
+            } else {
+                std::copy(a, a + na, next.begin() + nextBounds.back());
+                n = na;
+            }
+            nextBounds.push_back(nextBounds.back() + n);
+        }
+        std::swap(cur, next);
+        std::swap(bounds, nextBounds);
+    }
+
+    out.assign(cur.begin(), cur.begin() + bounds.back());
+}
+
+const char *sortedset::implementation() {
+    return kernels().name;
+}
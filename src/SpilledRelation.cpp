@@ -0,0 +1,302 @@
+#include <algorithm>
+#include <stdexcept>
+#include <unistd.h>
+#include "SpilledRelation.h"
+
+namespace {
+    const size_t minReadKeys = 256; // one 2 KB read per run refill at the least
+    const size_t maxFanIn = 64;
+
+    bool greaterKey(const std::pair<uint64_t, size_t> &a, const std::pair<uint64_t, size_t> &b) {
+        return a.first > b.first;
+    }
+
+    // a new, empty run file in the directory
+    FILE *createRun(const std::string &directory, std::string &path) {
+        path = directory + "/qs-spill-XXXXXX";
+        int fd = mkstemp(&path[0]);
+        if(fd < 0) throw std::runtime_error("Cannot create spill run in " + directory);
+        FILE *file = fdopen(fd, "wb");
+        if(file == nullptr) {
+            close(fd);
+            throw std::runtime_error("Cannot open spill run: " + path);
+        }
+        return file;
+    }
+
+    void writeKeys(FILE *file, const std::string &path, const std::vector<uint64_t> &keys) {
+        if(std::fwrite(keys.data(), sizeof(uint64_t), keys.size(), file) != keys.size()) {
+            std::fclose(file);
+            throw std::runtime_error("Writing spill run failed: " + path);
+        }
+    }
+}
+
+SpilledRelation::SpilledRelation(uint32_t n, std::vector<std::string> runFiles, std::shared_ptr<QueryArena> a, size_t readBytes)
+        : V(n), runs(std::move(runFiles)), arena(std::move(a)), read_bytes(readBytes) {}
+
+SpilledRelation::~SpilledRelation() {
+    for(auto &run : runs) std::remove(run.c_str());
+}
+
+PairCursor::PairCursor(const SpilledRelation &relation) : arena(relation.getArena()), has_last(false), last(0), tracked_bytes(0) {
+
+    auto &paths = relation.getRuns();
+    if(paths.empty()) return;
+
+    size_t keysPerRun = std::max(minReadKeys, relation.getReadBytes() / sizeof(uint64_t) / paths.size());
+    tracked_bytes = keysPerRun * paths.size() * sizeof(uint64_t);
+    arena->track(tracked_bytes);
+
+    for(auto &path : paths) {
+        FILE *file = std::fopen(path.c_str(), "rb");
+        if(file == nullptr) {
+            for(auto &run : runs) std::fclose(run.file);
+            arena->untrack(tracked_bytes);
+            throw std::runtime_error("Cannot open spill run: " + path);
+        }
+        // the run buffer is the only one, stdio would add another per open run
+        std::setvbuf(file, nullptr, _IONBF, 0);
+        runs.push_back(Run {file, std::vector<uint64_t>(keysPerRun), 0, 0});
+    }
+
+    for(size_t r = 0; r < runs.size(); r++) push(r);
+}
+
+PairCursor::~PairCursor() {
+    for(auto &run : runs) std::fclose(run.file);
+    if(tracked_bytes > 0) arena->untrack(tracked_bytes);
+}
+
+bool PairCursor::refill(Run &run) {
+    run.size = std::fread(run.buffer.data(), sizeof(uint64_t), run.buffer.size(), run.file);
+    run.position = 0;
+    return run.size > 0;
+}
+
+void PairCursor::push(size_t r) {
+    Run &run = runs[r];
+    if(run.position == run.size && !refill(run)) return;
+    heap.emplace_back(run.buffer[run.position++], r);
+    std::push_heap(heap.begin(), heap.end(), greaterKey);
+}
+
+void PairCursor::pop() {
+
+    Run &run = runs[heap.front().second];
+    if(run.position == run.size && !refill(run)) {
+        std::pop_heap(heap.begin(), heap.end(), greaterKey);
+        heap.pop_back();
+        return;
+    }
+
+    // the next key of the same run replaces the head in place, one sift-down instead of a
+    // pop and a push
+    heap.front().first = run.buffer[run.position++];
+    size_t i = 0;
+    while(true) {
+        size_t smallest = i, left = 2 * i + 1, right = left + 1;
+        if(left < heap.size() && heap[left].first < heap[smallest].first) smallest = left;
+        if(right < heap.size() && heap[right].first < heap[smallest].first) smallest = right;
+        if(smallest == i) break;
+        std::swap(heap[i], heap[smallest]);
+        i = smallest;
+    }
+}
+
+void PairCursor::skipDuplicates() {
+    // runs overlap, the same key can come from several of them
+    while(has_last && !heap.empty() && heap.front().first == last) pop();
+}
+
+bool PairCursor::next(uint64_t &key) {
+
+    skipDuplicates();
+    if(heap.empty()) return false;
+
+    key = last = heap.front().first;
+    has_last = true;
+    pop();
+    return true;
+}
+
+bool PairCursor::nextRow(uint32_t &source, std::vector<uint32_t> &targets) {
+
+    targets.clear();
+    skipDuplicates();
+    if(heap.empty()) return false;
+
+    // peek at the smallest head before taking it, a row ends where the source changes
+    uint64_t key = 0;
+    source = (uint32_t) (heap.front().first >> 32);
+    do {
+        next(key);
+        targets.push_back((uint32_t) key);
+        skipDuplicates();
+    } while(!heap.empty() && (uint32_t) (heap.front().first >> 32) == source);
+
+    return true;
+}
+
+RunWriter::RunWriter(std::string spillDirectory, size_t budgetBytes, std::shared_ptr<QueryArena> a)
+        : directory(std::move(spillDirectory)), arena(std::move(a)), budget(budgetBytes), sorted_run(nullptr) {
+    capacity = std::max<size_t>(budget / 2 / sizeof(uint64_t), 2 * minReadKeys);
+    fan_in = std::min(maxFanIn, std::max<size_t>(2, budget / 4 / (minReadKeys * sizeof(uint64_t))));
+    arena->track(capacity * sizeof(uint64_t));
+    buffer.reserve(capacity);
+}
+
+RunWriter::~RunWriter() {
+    if(sorted_run != nullptr) std::fclose(sorted_run);
+    for(auto &run : runs) std::remove(run.path.c_str());
+    arena->untrack(capacity * sizeof(uint64_t));
+}
+
+void RunWriter::compact() {
+
+    std::sort(buffer.begin(), buffer.end());
+    buffer.erase(std::unique(buffer.begin(), buffer.end()), buffer.end());
+
+    // a buffer of mostly duplicates keeps filling in memory
+    if(buffer.size() > capacity / 2) flush();
+}
+
+void RunWriter::flush() {
+
+    if(buffer.empty()) return;
+
+    // the buffer is sorted and distinct already
+    std::string path;
+    FILE *file = createRun(directory, path);
+    runs.push_back(Run {path, 0});
+    writeKeys(file, path, buffer);
+    std::fclose(file);
+    buffer.clear();
+    mergeTier();
+}
+
+void RunWriter::openRun() {
+    std::string path;
+    sorted_run = createRun(directory, path);
+    runs.push_back(Run {path, 0});
+}
+
+void RunWriter::writeSorted() {
+    FILE *file = sorted_run;
+    sorted_run = nullptr; // closed by writeKeys when it fails
+    writeKeys(file, runs.back().path, buffer);
+    sorted_run = file;
+    buffer.clear();
+}
+
+void RunWriter::endRun() {
+
+    if(sorted_run == nullptr) return;
+    writeSorted();
+    std::fclose(sorted_run);
+    sorted_run = nullptr;
+    mergeTier();
+}
+
+void RunWriter::mergeTier() {
+
+    // a full tier at the end becomes one run of the next tier
+    size_t n = 0;
+    while(n < runs.size() && runs[runs.size() - 1 - n].tier == runs.back().tier) n++;
+    if(n >= fan_in) mergeTail(n);
+}
+
+void RunWriter::mergeTail(size_t n) {
+
+    // the inputs go to a relation of their own, which removes them once they are merged
+    std::vector<std::string> inputs;
+    uint32_t tier = 0;
+    for(size_t i = runs.size() - n; i < runs.size(); i++) {
+        inputs.push_back(runs[i].path);
+        tier = std::max(tier, runs[i].tier);
+    }
+    runs.resize(runs.size() - n);
+    SpilledRelation merged(0, std::move(inputs), arena, budget / 4);
+    PairCursor cursor(merged);
+
+    // the buffer is empty between flushes and holds the output keys
+    std::string path;
+    FILE *file = createRun(directory, path);
+    runs.push_back(Run {path, tier + 1});
+    uint64_t key;
+    while(cursor.next(key)) {
+        buffer.push_back(key);
+        if(buffer.size() == capacity) {
+            writeKeys(file, path, buffer);
+            buffer.clear();
+        }
+    }
+    writeKeys(file, path, buffer);
+    std::fclose(file);
+    buffer.clear();
+}
+
+std::shared_ptr<SpilledRelation> RunWriter::finish(uint32_t n) {
+
+    endRun();
+    std::sort(buffer.begin(), buffer.end());
+    buffer.erase(std::unique(buffer.begin(), buffer.end()), buffer.end());
+    flush();
+
+    // the smallest runs are merged until a cursor opens at most fan_in of them
+    while(runs.size() > fan_in) mergeTail(std::min(fan_in, runs.size() - fan_in + 1));
+
+    std::vector<std::string> paths;
+    for(auto &run : runs) paths.push_back(run.path);
+    runs.clear();
+    return std::make_shared<SpilledRelation>(n, std::move(paths), arena, budget / 2);
+}
+
+RowSink::RowSink(uint32_t n, std::shared_ptr<QueryArena> a, size_t budgetBytes, std::string spillDirectory)
+        : V(n), arena(std::move(a)), budget(budgetBytes), directory(std::move(spillDirectory)) {
+    relation = std::make_shared<HybridRelation>(V, arena);
+}
+
+void RowSink::spill() {
+
+    // the rows arrive in source order with sorted targets, so they stream into a single run
+    writer.reset(new RunWriter(directory, budget / 4, arena));
+    for(uint32_t source = 0; source < V; source++) {
+        relation->forEachTarget(source, [&](uint32_t target) {
+            writer->addSorted((uint64_t) source << 32 | target);
+        });
+    }
+
+    relation.reset();
+    arena->release();
+}
+
+void RowSink::setRow(uint32_t source, const uint32_t *targets, uint32_t card) {
+
+    if(writer != nullptr) {
+        for(uint32_t i = 0; i < card; i++) writer->addSorted((uint64_t) source << 32 | targets[i]);
+        return;
+    }
+
+    relation->setRow(source, targets, card);
+    if(budget > 0 && relation->getUsedBytes() > budget) spill();
+}
+
+void RowSink::setRow(uint32_t source, const uint64_t *bits, uint32_t card) {
+
+    if(writer != nullptr) {
+        bitmap::forEach(bits, getNoWords(), [&](uint32_t target) {
+            writer->addSorted((uint64_t) source << 32 | target);
+        });
+        return;
+    }
+
+    relation->setRow(source, bits, card);
+    if(budget > 0 && relation->getUsedBytes() > budget) spill();
+}
+
+void RowSink::finish() {
+    if(writer == nullptr) return;
+    spilled = writer->finish(V);
+    writer.reset();
+}
@@ -0,0 +1,244 @@
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <regex>
+#include <set>
+#include <stdexcept>
+#include "ViewCatalog.h"
+
+namespace {
+    const char magic[8] = {'Q', 'S', 'V', 'I', 'E', 'W', 'S', '2'};
+
+    struct Fingerprint {
+        uint32_t noVertices;
+        uint32_t noLabels;
+        uint64_t noEdges;
+        uint64_t graphHash; // of the adjacency lists
+        uint64_t workloadHash; // of the query paths and the budget
+    };
+
+    uint64_t mix(uint64_t h, uint64_t value) {
+        h = (h ^ value) * 0x9e3779b97f4a7c15ull;
+        return h ^ (h >> 29);
+    }
+
+    Fingerprint fingerprintOf(const SimpleGraph &graph, const std::vector<std::string> &workload, size_t budget) {
+
+        // the rows are sorted on (label, target), so equal graphs hash the same
+        uint64_t graphHash = 0;
+        for(auto &row : graph.adj) {
+            graphHash = mix(graphHash, row.size());
+            for(auto &labelTarget : row) graphHash = mix(graphHash, (uint64_t) labelTarget.first << 32 | labelTarget.second);
+        }
+
+        uint64_t workloadHash = mix(0, budget);
+        for(auto &queryPath : workload) {
+            workloadHash = mix(workloadHash, queryPath.size());
+            for(char c : queryPath) workloadHash = mix(workloadHash, (uint8_t) c);
+        }
+
+        return Fingerprint {graph.getNoVertices(), graph.getNoLabels(), graph.getNoEdges(), graphHash, workloadHash};
+    }
+
+    template <typename T>
+    bool readValue(FILE *file, T &value) {
+        return std::fread(&value, sizeof(T), 1, file) == 1;
+    }
+
+    template <typename T>
+    void writeValue(FILE *file, const T &value) {
+        if(std::fwrite(&value, sizeof(T), 1, file) != 1) throw std::runtime_error("Writing the view file failed");
+    }
+}
+
+ViewCatalog::ViewCatalog(size_t budgetBytes) : arena(std::make_shared<QueryArena>()), budget(budgetBytes), used_bytes(0) {}
+
+LabelPath ViewCatalog::parsePath(const std::string &path) {
+
+    static const std::regex labelPat (R"((\d+)([+-]))");
+
+    LabelPath labels;
+    for(std::sregex_iterator it(path.begin(), path.end(), labelPat), end; it != end; ++it) {
+        labels.emplace_back((uint32_t) std::stoul((*it)[1]), (*it)[2] == "-");
+    }
+    return labels;
+}
+
+std::string ViewCatalog::toString(const LabelPath &path) {
+    std::string s;
+    for(auto &label : path) {
+        if(!s.empty()) s += "/";
+        s += std::to_string(label.first) + (label.second ? "-" : "+");
+    }
+    return s;
+}
+
+std::vector<std::pair<LabelPath, uint64_t>> ViewCatalog::analyze(const std::vector<std::string> &queryPaths) {
+
+    std::map<LabelPath, uint64_t> frequencies;
+
+    for(auto &queryPath : queryPaths) {
+        auto chain = parsePath(queryPath);
+
+        // a sub-path counts once per query, however often it repeats in it
+        std::set<LabelPath> seen;
+        for(size_t length = 2; length <= 3; length++) {
+            for(size_t i = 0; i + length <= chain.size(); i++) {
+                seen.emplace(chain.begin() + i, chain.begin() + i + length);
+            }
+        }
+        for(auto &path : seen) frequencies[path]++;
+    }
+
+    std::vector<std::pair<LabelPath, uint64_t>> candidates(frequencies.begin(), frequencies.end());
+    std::stable_sort(candidates.begin(), candidates.end(), [](const std::pair<LabelPath, uint64_t> &a,
+                                                              const std::pair<LabelPath, uint64_t> &b) {
+        return a.second > b.second;
+    });
+    return candidates;
+}
+
+bool ViewCatalog::add(const LabelPath &path, const HybridRelation &relation, const cardStat &stats) {
+
+    size_t bytes = relation.getNoBytes();
+    if(used_bytes + bytes > budget) return false;
+
+    auto copy = std::make_shared<HybridRelation>(relation.getNoVertices(), arena);
+    for(uint32_t source = 0; source < relation.getNoVertices(); source++) {
+        uint32_t card = relation.getRowSize(source);
+        if(card == 0) continue;
+        if(relation.isDense(source)) copy->setRow(source, relation.getBits(source), card);
+        else copy->setRow(source, relation.getTargets(source), card);
+    }
+
+    views.push_back(MaterializedView {path, copy, stats});
+    used_bytes += bytes;
+    return true;
+}
+
+const MaterializedView *ViewCatalog::match(const LabelPath &chain, size_t position) const {
+
+    const MaterializedView *best = nullptr;
+    for(auto &view : views) {
+        size_t length = view.path.size();
+        if(position + length > chain.size() || (best != nullptr && best->path.size() >= length)) continue;
+        if(std::equal(view.path.begin(), view.path.end(), chain.begin() + position)) best = &view;
+    }
+    return best;
+}
+
+void ViewCatalog::save(const std::string &fileName, const SimpleGraph &graph, const std::vector<std::string> &workload) const {
+
+    FILE *file = std::fopen(fileName.c_str(), "wb");
+    if(file == nullptr) throw std::runtime_error("Cannot write the view file: " + fileName);
+
+    try {
+        // magic, fingerprint, then per view its path, stats and non-empty rows. a row is stored
+        // the way the relation holds it, dense rows as their bitmap
+        std::fwrite(magic, sizeof(magic), 1, file);
+        writeValue(file, fingerprintOf(graph, workload, budget));
+        writeValue(file, (uint32_t) views.size());
+
+        for(auto &view : views) {
+            writeValue(file, (uint32_t) view.path.size());
+            for(auto &label : view.path) {
+                writeValue(file, label.first);
+                writeValue(file, (uint8_t) label.second);
+            }
+            writeValue(file, view.stats);
+
+            auto &relation = *view.relation;
+            writeValue(file, view.stats.noOut);
+            for(uint32_t source = 0; source < relation.getNoVertices(); source++) {
+                uint32_t card = relation.getRowSize(source);
+                if(card == 0) continue;
+                writeValue(file, source);
+                writeValue(file, card);
+                bool written = relation.isDense(source)
+                        ? std::fwrite(relation.getBits(source), sizeof(uint64_t), relation.getNoWords(), file) == relation.getNoWords()
+                        : std::fwrite(relation.getTargets(source), sizeof(uint32_t), card, file) == card;
+                if(!written) throw std::runtime_error("Writing the view file failed");
+            }
+        }
+    } catch(std::runtime_error &) {
+        std::fclose(file);
+        std::remove(fileName.c_str());
+        throw;
+    }
+
+    std::fclose(file);
+}
+
+bool ViewCatalog::load(const std::string &fileName, const SimpleGraph &graph, const std::vector<std::string> &workload) {
+
+    FILE *file = std::fopen(fileName.c_str(), "rb");
+    if(file == nullptr) return false;
+
+    clear();
+
+    char header[sizeof(magic)];
+    Fingerprint fingerprint {};
+    Fingerprint expected = fingerprintOf(graph, workload, budget);
+    uint32_t noViews = 0;
+    bool ok = std::fread(header, sizeof(header), 1, file) == 1 && std::equal(header, header + sizeof(header), magic)
+              && readValue(file, fingerprint) && fingerprint.noVertices == expected.noVertices
+              && fingerprint.noLabels == expected.noLabels && fingerprint.noEdges == expected.noEdges
+              && fingerprint.graphHash == expected.graphHash && fingerprint.workloadHash == expected.workloadHash
+              && readValue(file, noViews);
+
+    std::vector<uint32_t> targets;
+    std::vector<uint64_t> bits;
+    for(uint32_t v = 0; ok && v < noViews; v++) {
+        uint32_t length = 0, noRows = 0;
+        ok = readValue(file, length) && length <= 3;
+
+        LabelPath path;
+        for(uint32_t i = 0; ok && i < length; i++) {
+            uint32_t label;
+            uint8_t inverse;
+            ok = readValue(file, label) && readValue(file, inverse) && label < expected.noLabels;
+            path.emplace_back(label, inverse != 0);
+        }
+
+        cardStat stats {};
+        ok = ok && readValue(file, stats) && readValue(file, noRows);
+
+        auto relation = std::make_shared<HybridRelation>(expected.noVertices, arena);
+        for(uint32_t r = 0; ok && r < noRows; r++) {
+            uint32_t source = 0, card = 0;
+            ok = readValue(file, source) && readValue(file, card) && source < expected.noVertices && card <= expected.noVertices;
+            if(!ok) break;
+            if(relation->shouldBeDense(card)) {
+                // no bits past the last vertex, and exactly card of them set
+                bits.resize(relation->getNoWords());
+                ok = std::fread(bits.data(), sizeof(uint64_t), bits.size(), file) == bits.size()
+                     && (expected.noVertices % 64 == 0 || bits.back() >> (expected.noVertices % 64) == 0)
+                     && bitmap::popcount(bits.data(), bits.size()) == card;
+                if(ok) relation->setRow(source, bits.data(), card);
+            } else {
+                // ascending, distinct targets within the graph
+                targets.resize(card);
+                ok = std::fread(targets.data(), sizeof(uint32_t), card, file) == card;
+                for(uint32_t i = 0; ok && i < card; i++) {
+                    ok = targets[i] < expected.noVertices && (i == 0 || targets[i - 1] < targets[i]);
+                }
+                if(ok) relation->setRow(source, targets);
+            }
+        }
+
+        if(ok) {
+            views.push_back(MaterializedView {path, relation, stats});
+            used_bytes += relation->getNoBytes();
+        }
+    }
+
+    std::fclose(file);
+    if(!ok) clear();
+    return ok;
+}
+
+void ViewCatalog::clear() {
+    views.clear();
+    used_bytes = 0;
+    arena->release();
+}
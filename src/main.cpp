@@ -4,6 +4,10 @@
 #include <Estimator.h>
 #include <SimpleEstimator.h>
 #include <SimpleEvaluator.h>
+#include <SortedSet.h>
+#include <PartitionedEvaluator.h>
+#include <OperatorKernels.h>
+#include <random>
 
 
 struct query {
@@ -16,6 +20,19 @@ struct query {
     }
 };
 
+// optional command line settings of the benchmarks
+struct benchOptions {
+    size_t memoryBudget = 0; // spill threshold in bytes, 0 never spills
+    std::string spillDirectory {"/tmp"};
+    size_t memoryLimit = 0; // per query, 0 for none
+    uint32_t noWorkers = 0; // partitioned evaluation when > 0
+    uint64_t pairLimit = 0; // pairs streamed per query through a result cursor
+    std::string viewWorkload; // query log to pick materialized views from
+    size_t viewBudget = 64u << 20;
+    size_t reachabilityLimit = 64u << 20; // index bytes per label, 0 answers closure checks by traversal
+    size_t reachabilityTotal = 256u << 20; // index bytes over all labels
+};
+
 std::vector<query> parseQueries(std::string &fileName) {
 
     std::vector<query> queries {};
@@ -94,7 +111,14 @@ int estimatorBench(std::string &graphFile, std::string &queriesFile) {
         auto ev = std::make_unique<SimpleEvaluator>(g);
         ev->prepare();
         start = std::chrono::steady_clock::now();
-        auto actual = ev->evaluate(queryTree);
+        cardStat actual {};
+        try {
+            actual = ev->evaluate(queryTree);
+        } catch (std::runtime_error &e) {
+            std::cerr << e.what() << std::endl;
+            delete(queryTree);
+            continue;
+        }
         end = std::chrono::steady_clock::now();
 
         std::cout << "Actual (noOut, noPaths, noIn) : ";
@@ -109,7 +133,7 @@ int estimatorBench(std::string &graphFile, std::string &queriesFile) {
     return 0;
 }
 
-int evaluatorBench(std::string &graphFile, std::string &queriesFile) {
+int evaluatorBench(std::string &graphFile, std::string &queriesFile, benchOptions &options) {
 
     std::cout << "\n(1) Reading the graph into memory and preparing the evaluator...\n" << std::endl;
 
@@ -131,16 +155,50 @@ int evaluatorBench(std::string &graphFile, std::string &queriesFile) {
     auto est = std::make_shared<SimpleEstimator>(g);
     auto ev = std::make_unique<SimpleEvaluator>(g);
     ev->attachEstimator(est);
+    ev->setMemoryBudget(options.memoryBudget, options.spillDirectory);
+    ev->setMemoryLimit(options.memoryLimit);
+    ev->setReachabilityLimit(options.reachabilityLimit, options.reachabilityTotal);
+    if(!options.viewWorkload.empty()) {
+        std::vector<std::string> workload;
+        for(auto &q : parseQueries(options.viewWorkload)) workload.push_back(q.path);
+        ev->useViews(workload, options.viewBudget, graphFile + ".views");
+    }
 
     start = std::chrono::steady_clock::now();
     ev->prepare();
     end = std::chrono::steady_clock::now();
     std::cout << "Time to prepare the evaluator: " << std::chrono::duration<double, std::milli>(end - start).count() << " ms" << std::endl;
+    std::cout << "Graph memory: " << ev->getGraphMemory() << " bytes" << std::endl;
+    if(ev->getViews() != nullptr) {
+        std::cout << "Materialized views: " << ev->getViews()->getNoViews() << " ("
+                  << ev->getViews()->getUsedBytes() << " bytes)" << std::endl;
+    }
 
     std::cout << "\n(2) Running the query workload..." << std::endl;
 
+    // a closure over one label between two given vertices, e.g. "12, 3+*, 40"
+    std::regex closurePat (R"(^\s*(\d+)([+-])\*\s*$)");
+    std::regex vertexPat (R"(^\s*(\d+)\s*$)");
+
     for(auto query : parseQueries(queriesFile)) {
 
+        std::smatch closure, source, target;
+        if(std::regex_match(query.path, closure, closurePat) && std::regex_match(query.s, source, vertexPat)
+           && std::regex_match(query.t, target, vertexPat)) {
+            std::cout << "\nProcessing query: ";
+            query.print();
+
+            start = std::chrono::steady_clock::now();
+            bool reachable = ev->reachable((uint32_t) std::stoul(source[1]), (uint32_t) std::stoul(target[1]),
+                                           (uint32_t) std::stoul(closure[1]), closure[2] == "-");
+            end = std::chrono::steady_clock::now();
+
+            std::cout << "Reachable: " << (reachable ? "yes" : "no") << std::endl;
+            std::cout << "Time to check: " << std::chrono::duration<double, std::micro>(end - start).count() << " us" << std::endl;
+            std::cout << "Memory (peak, current): " << ev->getPeakMemory() << " bytes, " << ev->getCurrentMemory() << " bytes" << std::endl;
+            continue;
+        }
+
         // perform estimation
         // parse the query into an AST
         std::cout << "\nProcessing query: ";
@@ -151,35 +209,302 @@ int evaluatorBench(std::string &graphFile, std::string &queriesFile) {
 
         // perform the evaluation
         start = std::chrono::steady_clock::now();
-        auto actual = ev->evaluate(queryTree);
+        cardStat actual {};
+        try {
+            actual = ev->evaluate(queryTree);
+        } catch (std::runtime_error &e) {
+            std::cerr << e.what() << std::endl;
+            delete(queryTree);
+            continue;
+        }
         end = std::chrono::steady_clock::now();
 
         std::cout << "\nActual (noOut, noPaths, noIn) : ";
         actual.print();
         std::cout << "Time to evaluate: " << std::chrono::duration<double, std::milli>(end - start).count() << " ms" << std::endl;
+        std::cout << "Arena chunk allocations: " << ev->getNoArenaAllocations() << std::endl;
+        if(ev->getNoFactorizedJoins() > 0) std::cout << "Factorized joins: " << ev->getNoFactorizedJoins() << std::endl;
+        if(ev->getNoViewHits() > 0) std::cout << "View hits: " << ev->getNoViewHits() << std::endl;
+        std::cout << "Memory (peak, current): " << ev->getPeakMemory() << " bytes, " << ev->getCurrentMemory() << " bytes"
+                  << (ev->spilledForLimit() ? " (over the limit, rerun with spilling)" : "") << std::endl;
+
+        if(options.pairLimit > 0) {
+            // stream the first pairs of the answer
+            start = std::chrono::steady_clock::now();
+            auto cursor = ev->open(queryTree, options.pairLimit);
+            std::vector<std::pair<uint32_t, uint32_t>> batch;
+            std::cout << "First pairs:";
+            while(cursor->nextBatch(batch) > 0) {
+                for(auto &pair : batch) std::cout << " (" << pair.first << ", " << pair.second << ")";
+            }
+            end = std::chrono::steady_clock::now();
+            std::cout << "\nTime to stream " << cursor->getNoReturned() << " pairs: "
+                      << std::chrono::duration<double, std::milli>(end - start).count() << " ms" << std::endl;
+        }
 
         // clean-up
         delete(queryTree);
 
     }
 
+    if(ev->getReachabilityIndex() != nullptr) {
+        auto index = ev->getReachabilityIndex();
+        uint32_t noIndexed = 0;
+        for(uint32_t label = 0; label < g->getNoLabels(); label++) noIndexed += index->isIndexed(label);
+        std::cout << "\nReachability index: " << index->getNoBytes() << " bytes, " << noIndexed << " of "
+                  << g->getNoLabels() << " labels indexed, built in " << index->getBuildTime() << " ms" << std::endl;
+    }
+
+    return 0;
+}
+
+int partitionedBench(std::string &graphFile, std::string &queriesFile, uint32_t noWorkers) {
+
+    std::cout << "\n(1) Loading the graph shards into " << noWorkers << " worker processes...\n" << std::endl;
+
+    auto start = std::chrono::steady_clock::now();
+    std::unique_ptr<PartitionedEvaluator> ev;
+    try {
+        ev = std::make_unique<PartitionedEvaluator>(graphFile, noWorkers);
+    } catch (std::runtime_error &e) {
+        std::cerr << e.what() << std::endl;
+        return 0;
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    std::cout << "Time to load the shards: " << std::chrono::duration<double, std::milli>(end - start).count() << " ms" << std::endl;
+
+    std::cout << "\n(2) Running the query workload..." << std::endl;
+
+    for(auto query : parseQueries(queriesFile)) {
+
+        std::cout << "\nProcessing query: ";
+        query.print();
+
+        start = std::chrono::steady_clock::now();
+        cardStat actual {};
+        try {
+            actual = ev->evaluate(query.path);
+        } catch (std::runtime_error &e) {
+            std::cerr << e.what() << std::endl;
+            continue;
+        }
+        end = std::chrono::steady_clock::now();
+
+        std::cout << "\nActual (noOut, noPaths, noIn) : ";
+        actual.print();
+        std::cout << "Time to evaluate: " << std::chrono::duration<double, std::milli>(end - start).count() << " ms" << std::endl;
+        std::cout << "Exchanged pairs: " << ev->getNoExchangedPairs() << std::endl;
+    }
+
     return 0;
 }
 
 
+std::vector<uint32_t> randomSet(std::mt19937 &rng, size_t n, uint32_t universe) {
+    std::uniform_int_distribution<uint32_t> dist(0, universe - 1);
+    std::vector<uint32_t> set(n);
+    for(auto &v : set) v = dist(rng);
+    std::sort(set.begin(), set.end());
+    set.erase(std::unique(set.begin(), set.end()), set.end());
+    return set;
+}
+
+template <typename F>
+double timeKernel(int repetitions, F f) {
+    auto start = std::chrono::steady_clock::now();
+    for(int r = 0; r < repetitions; r++) f();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count() / repetitions;
+}
+
+int kernelBench() {
+
+    std::cout << "\nSorted-set kernels, dispatched implementation: " << sortedset::implementation() << std::endl;
+
+    std::mt19937 rng(42);
+    const int repetitions = 20;
+    bool ok = true;
+
+    auto report = [&](const std::string &name, double scalarMs, double simdMs, bool same) {
+        std::cout << name << ": scalar " << scalarMs << " ms, dispatched " << simdMs << " ms, speedup "
+                  << scalarMs / simdMs << (same ? "" : "  MISMATCH") << std::endl;
+        ok &= same;
+    };
+
+    for(size_t n : {1000, 100000, 1000000}) {
+
+        std::cout << "\n(n = " << n << ")" << std::endl;
+
+        auto a = randomSet(rng, n, (uint32_t) n * 4);
+        auto b = randomSet(rng, n, (uint32_t) n * 4);
+        std::vector<uint32_t> outScalar(a.size() + b.size()), outSimd(a.size() + b.size());
+        size_t nScalar = 0, nSimd = 0;
+
+        double scalarMs = timeKernel(repetitions, [&] { nScalar = sortedset::scalar::unite(a.data(), a.size(), b.data(), b.size(), outScalar.data()); });
+        double simdMs = timeKernel(repetitions, [&] { nSimd = sortedset::unite(a.data(), a.size(), b.data(), b.size(), outSimd.data()); });
+        report("union", scalarMs, simdMs, nScalar == nSimd && std::equal(outScalar.begin(), outScalar.begin() + nScalar, outSimd.begin()));
+
+        scalarMs = timeKernel(repetitions, [&] { nScalar = sortedset::scalar::intersect(a.data(), a.size(), b.data(), b.size(), outScalar.data()); });
+        simdMs = timeKernel(repetitions, [&] { nSimd = sortedset::intersect(a.data(), a.size(), b.data(), b.size(), outSimd.data()); });
+        report("intersection", scalarMs, simdMs, nScalar == nSimd && std::equal(outScalar.begin(), outScalar.begin() + nScalar, outSimd.begin()));
+
+        // sorted input with runs of duplicates, copied fresh for every repetition
+        std::vector<uint32_t> dups(a.size() + b.size());
+        std::merge(a.begin(), a.end(), b.begin(), b.end(), dups.begin());
+        scalarMs = timeKernel(repetitions, [&] { outScalar = dups; nScalar = sortedset::scalar::dedup(outScalar.data(), outScalar.size()); });
+        simdMs = timeKernel(repetitions, [&] { outSimd = dups; nSimd = sortedset::dedup(outSimd.data(), outSimd.size()); });
+        report("dedup", scalarMs, simdMs, nScalar == nSimd && std::equal(outScalar.begin(), outScalar.begin() + nScalar, outSimd.begin()));
+
+        std::vector<std::vector<uint32_t>> sets;
+        std::vector<std::pair<const uint32_t *, size_t>> lists;
+        for(int k = 0; k < 16; k++) sets.push_back(randomSet(rng, n / 16 + 1, (uint32_t) n * 4));
+        for(auto &set : sets) lists.emplace_back(set.data(), set.size());
+        std::vector<uint32_t> mergedScalar, mergedSimd;
+        scalarMs = timeKernel(repetitions, [&] { sortedset::scalar::kWayMerge(lists, mergedScalar); });
+        simdMs = timeKernel(repetitions, [&] { sortedset::kWayMerge(lists, mergedSimd); });
+        report("16-way merge", scalarMs, simdMs, mergedScalar == mergedSimd);
+    }
+
+    // the graph operators, every specialization against the generic version on a random graph
+    const uint32_t noVertices = 200000, noLabels = 8;
+    const size_t noEdges = 2000000;
+    auto graph = std::make_shared<SimpleGraph>(noVertices);
+    graph->setNoLabels(noLabels);
+    std::uniform_int_distribution<uint32_t> vertexDist(0, noVertices - 1), labelDist(0, noLabels - 1);
+    for(size_t e = 0; e < noEdges; e++) graph->appendEdge(vertexDist(rng), vertexDist(rng), labelDist(rng));
+    graph->sortRows();
+
+    std::vector<uint64_t> sourceFilter(bitmap::noWords(noVertices)), targetFilter(bitmap::noWords(noVertices));
+    for(auto &word : sourceFilter) word = ((uint64_t) rng() << 32) | rng();
+    for(auto &word : targetFilter) word = ((uint64_t) rng() << 32) | rng();
+
+    std::cout << "\nOperator kernels (" << noVertices << " vertices, " << noEdges << " edges, " << noLabels << " labels)" << std::endl;
+
+    auto reportKernel = [&](const std::string &name, double genericMs, double specializedMs, bool same) {
+        std::cout << name << ": generic " << genericMs << " ms, specialized " << specializedMs << " ms, speedup "
+                  << genericMs / specializedMs << (same ? "" : "  MISMATCH") << std::endl;
+        ok &= same;
+    };
+    auto sameRelation = [](const HybridRelation &a, const HybridRelation &b) {
+        std::vector<uint32_t> rowA, rowB;
+        for(uint32_t source = 0; source < a.getNoVertices(); source++) {
+            rowA.clear();
+            rowB.clear();
+            a.forEachTarget(source, [&](uint32_t target) { rowA.push_back(target); });
+            b.forEachTarget(source, [&](uint32_t target) { rowB.push_back(target); });
+            if(rowA != rowB) return false;
+        }
+        return true;
+    };
+
+    auto arena = std::make_shared<QueryArena>();
+    const int operatorRepetitions = 5;
+    std::shared_ptr<HybridRelation> outGeneric, outSpecialized;
+
+    for(bool inverse : {false, true}) {
+        for(bool sourceFiltered : {false, true}) {
+            for(bool targetFiltered : {false, true}) {
+                const uint64_t *sf = sourceFiltered ? sourceFilter.data() : nullptr;
+                const uint64_t *tf = targetFiltered ? targetFilter.data() : nullptr;
+                auto kernel = kernels::projectKernel(inverse, sourceFiltered, targetFiltered);
+
+                double genericMs = timeKernel(operatorRepetitions, [&] {
+                    outGeneric = std::make_shared<HybridRelation>(noVertices, arena);
+                    kernels::generic::project(*graph, 3, inverse, sf, tf, *outGeneric);
+                });
+                double specializedMs = timeKernel(operatorRepetitions, [&] {
+                    outSpecialized = std::make_shared<HybridRelation>(noVertices, arena);
+                    kernel(*graph, 3, sf, tf, *outSpecialized);
+                });
+                reportKernel("project (" + kernels::describe(inverse, sourceFiltered, targetFiltered) + ")",
+                             genericMs, specializedMs, sameRelation(*outGeneric, *outSpecialized));
+                outGeneric.reset();
+                outSpecialized.reset();
+                arena->release();
+            }
+        }
+    }
+
+    for(bool inverse : {false, true}) {
+        cardStat countGeneric {}, countSpecialized {};
+        auto kernel = kernels::countKernel(inverse);
+        double genericMs = timeKernel(operatorRepetitions, [&] { countGeneric = kernels::generic::count(*graph, 3, inverse); });
+        double specializedMs = timeKernel(operatorRepetitions, [&] { countSpecialized = kernel(*graph, 3); });
+        reportKernel("count (" + kernels::describe(inverse, false, false) + ")", genericMs, specializedMs,
+                     countGeneric.noOut == countSpecialized.noOut && countGeneric.noPaths == countSpecialized.noPaths
+                     && countGeneric.noIn == countSpecialized.noIn);
+    }
+
+    for(bool inverse : {false, true}) {
+        for(bool targetFiltered : {false, true}) {
+            const uint64_t *tf = targetFiltered ? targetFilter.data() : nullptr;
+            auto left = std::make_shared<HybridRelation>(noVertices, arena);
+            kernels::projectKernel(false, false, false)(*graph, 1, nullptr, nullptr, *left);
+            auto kernel = kernels::probeKernel<HybridRelation>(inverse, targetFiltered);
+
+            double genericMs = timeKernel(operatorRepetitions, [&] {
+                RowSink out(noVertices, arena);
+                kernels::generic::probe(*graph, 3, inverse, tf, *left, out);
+                out.finish();
+                outGeneric = out.getRelation();
+            });
+            double specializedMs = timeKernel(operatorRepetitions, [&] {
+                RowSink out(noVertices, arena);
+                kernel(*graph, 3, tf, *left, out);
+                out.finish();
+                outSpecialized = out.getRelation();
+            });
+            reportKernel("forward probe (" + kernels::describe(inverse, false, targetFiltered) + ")",
+                         genericMs, specializedMs, sameRelation(*outGeneric, *outSpecialized));
+            left.reset();
+            outGeneric.reset();
+            outSpecialized.reset();
+            arena->release();
+        }
+    }
+
+    return ok ? 0 : 1;
+}
+
+
 int main(int argc, char *argv[]) {
 
+    if(argc == 2 && std::string(argv[1]) == "--kernels") {
+        return kernelBench();
+    }
+
     if(argc < 3) {
-        std::cout << "Usage: quicksilver <graphFile> <queriesFile>" << std::endl;
+        std::cout << "Usage: quicksilver <graphFile> <queriesFile> [--memory-budget=<MB>] [--spill-dir=<dir>]"
+                  << " [--memory-limit=<MB>] [--pairs=<k>] [--views=<queryLog>] [--view-budget=<MB>]"
+                  << " [--reach-limit=<MB>] [--reach-total=<MB>]" << std::endl;
+        std::cout << "       quicksilver <graphFile> <queriesFile> --workers=<N>" << std::endl;
+        std::cout << "       quicksilver --kernels" << std::endl;
         return 0;
     }
 
     // args
     std::string graphFile {argv[1]};
     std::string queriesFile {argv[2]};
+    benchOptions options;
+
+    for(int i = 3; i < argc; i++) {
+        std::string option {argv[i]};
+        if(option.compare(0, 16, "--memory-budget=") == 0) options.memoryBudget = std::stoul(option.substr(16)) << 20;
+        else if(option.compare(0, 12, "--spill-dir=") == 0) options.spillDirectory = option.substr(12);
+        else if(option.compare(0, 15, "--memory-limit=") == 0) options.memoryLimit = std::stoul(option.substr(15)) << 20;
+        else if(option.compare(0, 10, "--workers=") == 0) options.noWorkers = (uint32_t) std::stoul(option.substr(10));
+        else if(option.compare(0, 8, "--pairs=") == 0) options.pairLimit = std::stoull(option.substr(8));
+        else if(option.compare(0, 8, "--views=") == 0) options.viewWorkload = option.substr(8);
+        else if(option.compare(0, 14, "--view-budget=") == 0) options.viewBudget = std::stoul(option.substr(14)) << 20;
+        else if(option.compare(0, 14, "--reach-limit=") == 0) options.reachabilityLimit = std::stoul(option.substr(14)) << 20;
+        else if(option.compare(0, 14, "--reach-total=") == 0) options.reachabilityTotal = std::stoul(option.substr(14)) << 20;
+    }
+
+    if(options.noWorkers > 0) return partitionedBench(graphFile, queriesFile, options.noWorkers);
 
     //estimatorBench(graphFile, queriesFile);
-    evaluatorBench(graphFile, queriesFile);
+    evaluatorBench(graphFile, queriesFile, options);
 
     return 0;
 }